@@ -0,0 +1,767 @@
+/*
+ * libstring benchmarks
+ *
+ * Times the hot public functions of libstring (with both the system allocator
+ * and the bundled pool allocator) against their closest libc equivalents, over
+ * a few input size distributions, and prints one CSV line per (benchmark,
+ * distribution, implementation):
+ *
+ *     benchmark,distribution,impl,ns_per_op,bytes_per_op
+ *
+ * bytes_per_op is the number of heap bytes requested (malloc + realloc)
+ * per operation. It is only measured when built with BENCH_COUNT_ALLOCS and
+ * linked with -Wl,--wrap=malloc,--wrap=realloc,--wrap=free (see run-bench.sh);
+ * otherwise it is reported as -1.
+ *
+ * Usage: bench [filter]
+ *     Only benchmarks whose name contains `filter` are run.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/libstring.h"
+#include <ctype.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INPUT_COUNT   256
+#define BATCH         64
+#define TARGET_NS     50e6
+#define REPETITIONS   5
+
+//! **** Allocation counting **** !//
+
+#ifdef BENCH_COUNT_ALLOCS
+void * __real_malloc(size_t size);
+void * __real_realloc(void * ptr, size_t size);
+void   __real_free(void * ptr);
+
+static size_t allocated_bytes = 0;
+
+void * __wrap_malloc(size_t size)
+{
+    allocated_bytes += size;
+    return __real_malloc(size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size)
+{
+    allocated_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void * ptr)
+{
+    __real_free(ptr);
+}
+#endif
+
+//! **** Inputs **** !//
+
+struct distribution
+{
+    const char * name;
+    size_t       min_len;
+    size_t       max_len;
+};
+
+static const struct distribution distributions[] =
+{
+    { "tiny",   1,     16    },
+    { "small",  16,    128   },
+    { "medium", 256,   2048  },
+    { "large",  16384, 65536 },
+};
+
+struct input
+{
+    char * strs[INPUT_COUNT];
+    size_t lens[INPUT_COUNT];
+    size_t max_len;
+};
+
+static const char * words[] =
+{
+    "lorem", "IPSUM", "Dolor", "sit", "amet", "home/user", "Carmesim", "the", "PROJECT", "oompa", "loompa",
+};
+
+//! Fills `in` with strings of random words (some of them mixed case) whose lengths follow `dist`.
+static void input_init(struct input * in, const struct distribution * dist)
+{
+    size_t i, nwords = sizeof(words) / sizeof(words[0]);
+
+    in->max_len = dist->max_len;
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        size_t len = dist->min_len + (size_t) rand() % (dist->max_len - dist->min_len + 1);
+        size_t pos = 0;
+        char * s   = malloc(len + 1);
+
+        while (pos < len)
+        {
+            const char * w = words[(size_t) rand() % nwords];
+            while (*w && pos < len)
+            {
+                s[pos++] = *w++;
+            }
+            if (pos < len)
+            {
+                s[pos++] = ' ';
+            }
+        }
+        s[len] = '\0';
+        in->strs[i] = s;
+        in->lens[i] = len;
+    }
+}
+
+static void input_free(struct input * in)
+{
+    size_t i;
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        free(in->strs[i]);
+    }
+}
+
+//! **** Benchmarks **** !//
+//! Each one performs `ops` operations and returns something derived from them so that they can't be optimized away.
+
+static volatile size_t sink;
+
+static size_t init_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_init(in->strs[i % INPUT_COUNT])->size;
+        if (i % BATCH == BATCH - 1)
+        {
+            string_free_all();
+        }
+    }
+    string_free_all();
+    return acc;
+}
+
+static size_t init_libc(struct input * in, size_t ops)
+{
+    char * batch[BATCH];
+    size_t i, j, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        size_t len = strlen(in->strs[i % INPUT_COUNT]);
+        batch[i % BATCH] = malloc(len + 1);
+        memcpy(batch[i % BATCH], in->strs[i % INPUT_COUNT], len + 1);
+        acc += len;
+        if (i % BATCH == BATCH - 1 || i == ops - 1)
+        {
+            for (j = 0; j <= i % BATCH; j++)
+            {
+                free(batch[j]);
+            }
+        }
+    }
+    return acc;
+}
+
+static size_t concat_to_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t * str = string_init("");
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_concat_to(str, in->strs[i % INPUT_COUNT]);
+        if (i % BATCH == BATCH - 1)
+        {
+            string_free_all();
+            str = string_init("");
+        }
+    }
+    string_free_all();
+    return acc;
+}
+
+static size_t concat_to_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0, len = 0;
+    char * str = calloc(1, 1);
+    for (i = 0; i < ops; i++)
+    {
+        size_t add = strlen(in->strs[i % INPUT_COUNT]);
+        str = realloc(str, len + add + 1);
+        memcpy(str + len, in->strs[i % INPUT_COUNT], add + 1);
+        len += add;
+        acc += add;
+        if (i % BATCH == BATCH - 1)
+        {
+            free(str);
+            str = calloc(1, 1);
+            len = 0;
+        }
+    }
+    free(str);
+    return acc;
+}
+
+//! string_replace works in place, so every operation first restores the original value.
+static size_t replace_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t * str = string_init("");
+    for (i = 0; i < ops; i++)
+    {
+        string_update(str, in->strs[i % INPUT_COUNT]);
+        string_replace(str, "home/user", "~");
+        acc += str->value[0];
+    }
+    string_free_all();
+    return acc;
+}
+
+static size_t replace_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    char * out = malloc(in->max_len + 1);
+    for (i = 0; i < ops; i++)
+    {
+        const char * src = in->strs[i % INPUT_COUNT], * hit;
+        char * dest = out;
+        while ((hit = strstr(src, "home/user")))
+        {
+            memcpy(dest, src, (size_t) (hit - src));
+            dest += hit - src;
+            *dest++ = '~';
+            src = hit + 9;
+        }
+        strcpy(dest, src);
+        acc += out[0];
+    }
+    free(out);
+    return acc;
+}
+
+//! Inputs that are only read are wrapped in unregistered cstr_t's, so that setting them up is not timed.
+static void wrap_inputs(struct input * in, cstr_t * strs)
+{
+    size_t i;
+    for (i = 0; i < INPUT_COUNT; i++)
+    {
+        strs[i].value    = in->strs[i];
+        strs[i].size     = in->lens[i];
+        strs[i].reserved = in->lens[i] + 1;
+        strs[i].flags    = 0;
+    }
+}
+
+static size_t contains_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_contains(&strs[i % INPUT_COUNT], "needle");
+    }
+    return acc;
+}
+
+static size_t contains_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        acc += strstr(in->strs[i % INPUT_COUNT], "needle") != NULL;
+    }
+    return acc;
+}
+
+//! One operation tokenizes a whole string. Both tokenizers are destructive, so they work on a scratch copy.
+static size_t tokenize_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    char * scratch = malloc(in->max_len + 1);
+    for (i = 0; i < ops; i++)
+    {
+        char * tok;
+        memcpy(scratch, in->strs[i % INPUT_COUNT], in->lens[i % INPUT_COUNT] + 1);
+        for (tok = string_first_token(scratch, " "); tok; tok = string_get_token(" "))
+        {
+            acc++;
+        }
+    }
+    free(scratch);
+    return acc;
+}
+
+static size_t tokenize_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    char * scratch = malloc(in->max_len + 1);
+    for (i = 0; i < ops; i++)
+    {
+        char * tok, * save;
+        memcpy(scratch, in->strs[i % INPUT_COUNT], in->lens[i % INPUT_COUNT] + 1);
+        for (tok = strtok_r(scratch, " ", &save); tok; tok = strtok_r(NULL, " ", &save))
+        {
+            acc++;
+        }
+    }
+    free(scratch);
+    return acc;
+}
+
+static size_t to_lower_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_to_lower_case(&strs[i % INPUT_COUNT])->size;
+        if (i % BATCH == BATCH - 1)
+        {
+            string_free_all();
+        }
+    }
+    string_free_all();
+    return acc;
+}
+
+static size_t to_lower_libc(struct input * in, size_t ops)
+{
+    char * batch[BATCH];
+    size_t i, j, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        const char * src = in->strs[i % INPUT_COUNT];
+        size_t len = in->lens[i % INPUT_COUNT];
+        char * dest = malloc(len + 1);
+        for (j = 0; j <= len; j++)
+        {
+            dest[j] = (char) tolower((unsigned char) src[j]);
+        }
+        batch[i % BATCH] = dest;
+        acc += len;
+        if (i % BATCH == BATCH - 1 || i == ops - 1)
+        {
+            for (j = 0; j <= i % BATCH; j++)
+            {
+                free(batch[j]);
+            }
+        }
+    }
+    return acc;
+}
+
+//! One operation splits a whole string at every space.
+static size_t split_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        size_t count;
+        string_split_free(string_split(&strs[i % INPUT_COUNT], " ", &count));
+        acc += count;
+    }
+    return acc;
+}
+
+//! The libc way: tokenize a scratch copy and duplicate every token.
+static size_t split_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    char * scratch = malloc(in->max_len + 1);
+    for (i = 0; i < ops; i++)
+    {
+        char * tok, * save;
+        memcpy(scratch, in->strs[i % INPUT_COUNT], in->lens[i % INPUT_COUNT] + 1);
+        for (tok = strtok_r(scratch, " ", &save); tok; tok = strtok_r(NULL, " ", &save))
+        {
+            char * piece = malloc(strlen(tok) + 1);
+            memcpy(piece, tok, strlen(tok) + 1);
+            acc += piece[0] != '\0';
+            free(piece);
+        }
+    }
+    free(scratch);
+    return acc;
+}
+
+//! One operation joins the words of a string back with ", ". The words are split beforehand.
+static size_t join_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    cstr_view_t * parts[INPUT_COUNT];
+    size_t counts[INPUT_COUNT];
+    size_t used = ops < INPUT_COUNT ? ops : INPUT_COUNT;   //! Only split what gets joined
+    wrap_inputs(in, strs);
+    for (i = 0; i < used; i++)
+    {
+        parts[i] = string_split(&strs[i], " ", &counts[i]);
+    }
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_join(parts[i % INPUT_COUNT], counts[i % INPUT_COUNT], ", ")->size;
+        if (i % BATCH == BATCH - 1)
+        {
+            string_free_all();
+        }
+    }
+    string_free_all();
+    for (i = 0; i < used; i++)
+    {
+        string_split_free(parts[i]);
+    }
+    return acc;
+}
+
+static size_t join_libc(struct input * in, size_t ops)
+{
+    cstr_t strs[INPUT_COUNT];
+    cstr_view_t * parts[INPUT_COUNT];
+    size_t counts[INPUT_COUNT];
+    char * batch[BATCH];
+    size_t i, j, acc = 0;
+    size_t used = ops < INPUT_COUNT ? ops : INPUT_COUNT;   //! Only split what gets joined
+    wrap_inputs(in, strs);
+    for (i = 0; i < used; i++)
+    {
+        parts[i] = string_split(&strs[i], " ", &counts[i]);
+    }
+    for (i = 0; i < ops; i++)
+    {
+        const cstr_view_t * words = parts[i % INPUT_COUNT];
+        size_t count = counts[i % INPUT_COUNT], len = 0;
+        char * dest;
+        for (j = 0; j < count; j++)
+        {
+            len += words[j].size + (j ? 2 : 0);
+        }
+        dest = batch[i % BATCH] = malloc(len + 1);
+        for (j = 0; j < count; j++)
+        {
+            if (j)
+            {
+                memcpy(dest, ", ", 2);
+                dest += 2;
+            }
+            memcpy(dest, words[j].value, words[j].size);
+            dest += words[j].size;
+        }
+        *dest = '\0';
+        acc += len;
+        if (i % BATCH == BATCH - 1 || i == ops - 1)
+        {
+            for (j = 0; j <= i % BATCH; j++)
+            {
+                free(batch[j]);
+            }
+        }
+    }
+    for (i = 0; i < used; i++)
+    {
+        string_split_free(parts[i]);
+    }
+    return acc;
+}
+
+//! Both patterns are compiled once per run, and the libc one is matched against NUL-terminated copies.
+#define BENCH_REGEX "(oompa|loompa) [a-z]+ Carmesim"
+
+static size_t regex_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    string_regex_t * re = string_regex_compile(BENCH_REGEX);
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_regex_match(re, &strs[i % INPUT_COUNT]);
+    }
+    string_regex_free(re);
+    return acc;
+}
+
+static size_t regex_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    regex_t re;
+    regcomp(&re, BENCH_REGEX, REG_EXTENDED | REG_NOSUB);
+    for (i = 0; i < ops; i++)
+    {
+        acc += regexec(&re, in->strs[i % INPUT_COUNT], 0, NULL, 0) == 0;
+    }
+    regfree(&re);
+    return acc;
+}
+
+//! The libc way: lower-case copies of both sides, then strstr.
+static size_t contains_nocase_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_contains_nocase(&strs[i % INPUT_COUNT], "CARMESIM project");
+    }
+    return acc;
+}
+
+static size_t contains_nocase_libc(struct input * in, size_t ops)
+{
+    size_t i, j, acc = 0;
+    char needle[] = "CARMESIM project";
+    for (j = 0; needle[j]; j++)
+    {
+        needle[j] = (char) tolower((unsigned char) needle[j]);
+    }
+    for (i = 0; i < ops; i++)
+    {
+        const char * src = in->strs[i % INPUT_COUNT];
+        size_t len = in->lens[i % INPUT_COUNT];
+        char * lower = malloc(len + 1);
+        for (j = 0; j <= len; j++)
+        {
+            lower[j] = (char) tolower((unsigned char) src[j]);
+        }
+        acc += strstr(lower, needle) != NULL;
+        free(lower);
+    }
+    return acc;
+}
+
+static size_t count_char_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        acc += string_count_char(&strs[i % INPUT_COUNT], 'e');
+    }
+    return acc;
+}
+
+static size_t count_char_libc(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        const char * src = in->strs[i % INPUT_COUNT];
+        const char * end = src + in->lens[i % INPUT_COUNT];
+        while ((src = memchr(src, 'e', (size_t) (end - src))) != NULL)
+        {
+            acc++;
+            src++;
+        }
+    }
+    return acc;
+}
+
+static size_t base64_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        cstr_t * encoded = string_base64_encode(&strs[i % INPUT_COUNT]);
+        acc += encoded->size;
+        string_free(encoded);
+    }
+    return acc;
+}
+
+/* There's no base64 in libc: this is the usual scalar, table-driven encoder */
+static size_t base64_libc(struct input * in, size_t ops)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, j, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        const unsigned char * src = (const unsigned char *) in->strs[i % INPUT_COUNT];
+        size_t len = in->lens[i % INPUT_COUNT];
+        char * out = malloc((len + 2) / 3 * 4 + 1), * dest = out;
+        for (j = 0; j < len; j += 3)
+        {
+            unsigned long group = (unsigned long) src[j] << 16
+                                | (j + 1 < len ? (unsigned long) src[j + 1] << 8 : 0)
+                                | (j + 2 < len ? src[j + 2] : 0);
+            *dest++ = alphabet[group >> 18];
+            *dest++ = alphabet[group >> 12 & 0x3F];
+            *dest++ = j + 1 < len ? alphabet[group >> 6 & 0x3F] : '=';
+            *dest++ = j + 2 < len ? alphabet[group & 0x3F] : '=';
+        }
+        *dest = '\0';
+        acc += (size_t) (dest - out);
+        free(out);
+    }
+    return acc;
+}
+
+static size_t json_escape_libstring(struct input * in, size_t ops)
+{
+    size_t i, acc = 0;
+    cstr_t strs[INPUT_COUNT];
+    wrap_inputs(in, strs);
+    for (i = 0; i < ops; i++)
+    {
+        cstr_t * escaped = string_json_escape(&strs[i % INPUT_COUNT]);
+        acc += escaped->size;
+        string_free(escaped);
+    }
+    return acc;
+}
+
+/* The usual escaper: a worst-case buffer, filled one char at a time */
+static size_t json_escape_libc(struct input * in, size_t ops)
+{
+    size_t i, j, acc = 0;
+    for (i = 0; i < ops; i++)
+    {
+        const char * src = in->strs[i % INPUT_COUNT];
+        size_t len = in->lens[i % INPUT_COUNT];
+        char * out = malloc(len * 6 + 1), * dest = out;
+        for (j = 0; j < len; j++)
+        {
+            unsigned char c = (unsigned char) src[j];
+            if (c == '"' || c == '\\')
+            {
+                *dest++ = '\\';
+                *dest++ = (char) c;
+            }
+            else if (c < 0x20)
+            {
+                dest += sprintf(dest, "\\u%04x", c);
+            }
+            else
+            {
+                *dest++ = (char) c;
+            }
+        }
+        *dest = '\0';
+        acc += (size_t) (dest - out);
+        free(out);
+    }
+    return acc;
+}
+
+struct bench_case
+{
+    const char * name;
+    size_t (*libstring)(struct input * in, size_t ops);
+    size_t (*libc)(struct input * in, size_t ops);
+};
+
+static const struct bench_case cases[] =
+{
+    { "string_init",          init_libstring,      init_libc      },
+    { "string_concat_to",     concat_to_libstring, concat_to_libc },
+    { "string_replace",       replace_libstring,   replace_libc   },
+    { "string_contains",      contains_libstring,  contains_libc  },
+    { "string_get_token",     tokenize_libstring,  tokenize_libc  },
+    { "string_to_lower_case", to_lower_libstring,  to_lower_libc  },
+    { "string_split",         split_libstring,     split_libc     },
+    { "string_join",          join_libstring,      join_libc      },
+    { "string_regex_match",   regex_libstring,     regex_libc     },
+    { "string_contains_nocase", contains_nocase_libstring, contains_nocase_libc },
+    { "string_count_char",    count_char_libstring, count_char_libc },
+    { "string_base64_encode", base64_libstring,    base64_libc    },
+    { "string_json_escape",   json_escape_libstring, json_escape_libc },
+};
+
+//! **** Driver **** !//
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+//! Runs `fn` until it takes TARGET_NS, then reports the best of REPETITIONS runs.
+static void measure(const char * bench, const char * dist, const char * impl,
+                    size_t (*fn)(struct input *, size_t), struct input * in)
+{
+    size_t ops = 1;
+    double elapsed, best = -1;
+    long long bytes = -1;
+    int rep;
+
+    for (;;)
+    {
+        double start = now_ns();
+        sink = fn(in, ops);
+        elapsed = now_ns() - start;
+        if (elapsed >= TARGET_NS / 10 || ops >= ((size_t) 1 << 30))
+        {
+            break;
+        }
+        ops *= 2;
+    }
+    ops = (size_t) ((double) ops * (TARGET_NS / (elapsed > 0 ? elapsed : 1))) + 1;
+
+    for (rep = 0; rep < REPETITIONS; rep++)
+    {
+        double start;
+#ifdef BENCH_COUNT_ALLOCS
+        allocated_bytes = 0;
+#endif
+        start = now_ns();
+        sink = fn(in, ops);
+        elapsed = now_ns() - start;
+#ifdef BENCH_COUNT_ALLOCS
+        bytes = (long long) (allocated_bytes / ops);
+#endif
+        if (best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    printf("%s,%s,%s,%.2f,%lld\n", bench, dist, impl, best / (double) ops, bytes);
+    fflush(stdout);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * filter = argc > 1 ? argv[1] : "";
+    string_pool_t * pool = string_pool_create();
+    string_allocator_t pool_hooks = string_pool_allocator(pool);
+    size_t c, d;
+
+    printf("benchmark,distribution,impl,ns_per_op,bytes_per_op\n");
+    for (d = 0; d < sizeof(distributions) / sizeof(distributions[0]); d++)
+    {
+        struct input in;
+        srand(42);
+        input_init(&in, &distributions[d]);
+
+        for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+        {
+            if (!strstr(cases[c].name, filter))
+            {
+                continue;
+            }
+            measure(cases[c].name, distributions[d].name, "libstring", cases[c].libstring, &in);
+
+            //! Every benchmark frees its strings before returning, so allocators can be switched in between
+            string_set_allocator(&pool_hooks);
+            measure(cases[c].name, distributions[d].name, "libstring_pool", cases[c].libstring, &in);
+            string_set_allocator(NULL);
+
+            measure(cases[c].name, distributions[d].name, "libc",      cases[c].libc,      &in);
+        }
+        input_free(&in);
+    }
+    string_pool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Usage: ./run-bench.sh [baseline.csv] [filter]
+# Writes the results to ../bench_output.txt. If a baseline (a previous
+# bench_output.txt) is given, also prints how much each result changed.
+echo "Building libstring benchmarks (-O2, -std=gnu11)"
+gcc -std=gnu11 -O2 -DBENCH_COUNT_ALLOCS -Wl,--wrap=malloc,--wrap=realloc,--wrap=free -o bench bench.c ../src/libstring.c || exit 1
+
+./bench "$2" | tee ../bench_output.txt
+
+if [ -n "$1" ]; then
+    echo
+    echo "Compared to $1 (negative is faster):"
+    awk -F, 'NR == FNR { if (FNR > 1) base[$1 "," $2 "," $3] = $4; next }
+             FNR > 1 && ($1 "," $2 "," $3) in base && base[$1 "," $2 "," $3] > 0 {
+                 printf "%-24s %-8s %-10s %10.2f -> %10.2f ns/op (%+.1f%%)\n",
+                        $1, $2, $3, base[$1 "," $2 "," $3], $4, 100 * ($4 / base[$1 "," $2 "," $3] - 1)
+             }' "$1" ../bench_output.txt
+fi
@@ -26,32 +26,165 @@
  */
 
 #include "libstring.h"
-#include <stdio.h>
 
+#ifdef LIBSTRING_RELEASE
+#   include <assert.h>
+#else
+#   include <stdio.h>
+#endif
+
+//! Every alternative definition of a macro below is preceded by an #undef. The C89 test strips comments
+//! with `gcc -fpreprocessed -dD -E`, which reads every #define whatever the #if around it: this keeps that
+//! pass free of redefinition warnings, so a real one (which the test treats as a failure) stands out.
 #ifdef __STDC_VERSION__
 #   define LIBSTRING_INLINE inline
 #else
+#   undef  LIBSTRING_INLINE
 #   define LIBSTRING_INLINE
 #endif
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#   define LIBSTRING_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#   undef  LIBSTRING_THREAD_LOCAL
+#   define LIBSTRING_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#   undef  LIBSTRING_THREAD_LOCAL
+#   define LIBSTRING_THREAD_LOCAL __declspec(thread)
+#else
+#   undef  LIBSTRING_THREAD_LOCAL
+#   define LIBSTRING_THREAD_LOCAL
+#endif
+
+#define LIBSTRING_TABLE_LEN(table) (sizeof(table) / sizeof((table)[0]))
+
+//! Pointers into different objects can only be compared as integers. C89 has no uintptr_t, but
+//! size_t is as wide as a pointer on every flat-memory platform.
+#if (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L) || defined(__cplusplus)
+#   include <stdint.h>
+typedef uintptr_t cstr_uintptr_t;
+#else
+typedef size_t cstr_uintptr_t;
+#endif
+
+//! **** Error reporting **** !//
+
+#ifndef LIBSTRING_RELEASE
+//!
+//! \brief __default_error_handler Prints the error message to stderr, as libstring always did.
+//!
+static void __default_error_handler(enum string_error error, const char * message, void * context)
+{
+    (void) context;
+    fprintf(stderr, "%s (%s)\n", message, string_error_description(error));
+}
+#   define LIBSTRING_DEFAULT_ERROR_HANDLER __default_error_handler
+#else
+    //! Release builds stay silent (and stdio-free) unless a handler gets installed.
+#   undef  LIBSTRING_DEFAULT_ERROR_HANDLER
+#   define LIBSTRING_DEFAULT_ERROR_HANDLER NULL
+#endif
+
+static LIBSTRING_THREAD_LOCAL enum string_error last_error = STRING_OK;
+static string_error_handler_t error_handler         = LIBSTRING_DEFAULT_ERROR_HANDLER;
+static void                 * error_handler_context = NULL;
+
+//!
+//! \brief __string_error Records an error for string_last_error() and hands it to the error handler.
+//! \param error          What went wrong.
+//! \param message        Where it went wrong, e.g. "In string_x: string_reserve failed."
+//!
+static void __string_error(enum string_error error, const char * message)
+{
+    last_error = error;
+    if (error_handler)
+    {
+        error_handler(error, message, error_handler_context);
+    }
+}
+
+//! Sanity checks are compiled down to assertions on release builds (so they disappear with NDEBUG).
+#ifdef LIBSTRING_RELEASE
+#   define LIBSTRING_SANITY_CHECK(str, where) (assert((str) && (str)->size <= (str)->reserved), true)
+#else
+#   undef  LIBSTRING_SANITY_CHECK
+#   define LIBSTRING_SANITY_CHECK(str, where) sanity_check((str), (where))
+#endif
+
 //! **** Defining internal functions **** !//
 
+//! **** Allocator hooks **** !//
+
+static void * __system_allocate(void * context, size_t size)
+{
+    (void) context;
+    return malloc(size);
+}
+
+static void * __system_reallocate(void * context, void * ptr, size_t old_size, size_t new_size)
+{
+    (void) context;
+    (void) old_size;
+    return realloc(ptr, new_size);
+}
+
+static void __system_deallocate(void * context, void * ptr, size_t size)
+{
+    (void) context;
+    (void) size;
+    free(ptr);
+}
+
+//! Every allocation made by libstring goes through this. See string_set_allocator().
+static string_allocator_t allocator = { __system_allocate, __system_reallocate, __system_deallocate, NULL };
+
+//! Blocks handed out by `allocator` that haven't been given back yet: strings, split arrays, regexes and indexes alike
+static size_t live_blocks = 0;
+
 //!
-//! \brief __malloc Simple error-printing wrapper around malloc.
+//! \brief __malloc Simple error-reporting wrapper around the allocator's `allocate` hook.
 //! \param size     Quantity of memory to be allocated
 //! \return         A pointer to the allocated memory.
 //!
 static void * __malloc(size_t size)
 {
-    void * ptr = malloc(size);
+    void * ptr = allocator.allocate(allocator.context, size);
     if(!ptr)
     {
-        fprintf(stderr, "Fatal error: malloc failed!\n");
+        __string_error(STRING_ERR_ALLOC, "Fatal error: malloc failed!");
         // TODO: exit?
+        return NULL;
     }
+    live_blocks++;
     return ptr;
 }
 
+//!
+//! \brief __realloc Wrapper around the allocator's `reallocate` hook.
+//! \param ptr       The block to be resized. Left untouched if reallocation fails.
+//! \param old_size  The current size of the block.
+//! \param new_size  The requested size of the block.
+//! \return          The resized block, or NULL on failure.
+//!
+static LIBSTRING_INLINE void * __realloc(void * ptr, size_t old_size, size_t new_size)
+{
+    return allocator.reallocate(allocator.context, ptr, old_size, new_size);
+}
+
+//!
+//! \brief __free Wrapper around the allocator's `deallocate` hook.
+//! \param ptr    The block to be freed.
+//! \param size   The size the block was allocated (or last reallocated) with.
+//!
+static LIBSTRING_INLINE void __free(void * ptr, size_t size)
+{
+    if (ptr)
+    {
+        live_blocks--;
+    }
+    allocator.deallocate(allocator.context, ptr, size);
+}
+
 //!
 //! \brief __strlen Portable and simple reimplementation of strlen
 //! \param s        The NUL-terminated char array whose length will be calculated.
@@ -155,7 +288,8 @@ static char * __strtok(char *str, char *delim, char ** prev)
 //! \param dest      The destination char array, whose contents will be written to src.
 //! \param src       The source char array, where the contents of dest will be written to.
 //! \param n         The quantity of elements to be copied.
-//! \return          Returns the destination char array.
+//! \return          Returns a pointer one past the last element written to dest.
+//! Copies forward, so the arrays may overlap as long as dest comes before src.
 //!
 static LIBSTRING_INLINE char * __memcpy(char * dest, const char *src, size_t n) {
    while (n--)
@@ -165,51 +299,6 @@ static LIBSTRING_INLINE char * __memcpy(char * dest, const char *src, size_t n)
    return dest;
 }
 
-//!
-//! \brief __strcpy  A simple string copy function. It will always null-terminate the destination char array.
-//! \param dest      Destination char array.
-//! \param src       Source char array.
-//! \param size      Quantitity of elements to be copied. It may be larger than __strlen(src), but the function will not write more than __strlen(src).
-//!
-static size_t __strcpy(char *dest, const char *src, size_t size)
-{
-    if (!dest || !src)
-    {
-        return 0;
-    }
-
-    if(!size)
-    {
-        fprintf(stderr, "In __strcpy: `size` should not be 0.\n");
-        return 0;
-    }
-
-    size_t source_len = __strlen(src);
-    size_t n;
-
-    if (size < source_len)    // Truncate to the size of the smaller string
-    {
-        n = size;
-    } else
-    {
-        n = source_len;
-    }
-
-    __memcpy(dest, src, n);      // Copy the contents of src to dest
-    dest[n] = '\0';              // Null-terminate dest.
-    return source_len;
-}
-
-static size_t __strncat(char *dest, const char *src, size_t size)
-{
-    size_t dest_len = __strlen(dest);
-    if (dest_len < size)
-    {
-        return(dest_len + __strcpy(dest + dest_len, src, size - dest_len));
-    }
-    return(dest_len + __strlen(src));
-}
-
 //!
 //! \brief __cstr_min Quick internal implementation of a min function for size_t.
 //! \param x One of the elements to be compared.
@@ -230,563 +319,4641 @@ static LIBSTRING_INLINE size_t __cstr_min(size_t x, size_t y)
 //! \param y The other element to be compared.
 //! \return The greater element.
 //!
-//static size_t __cstr_max(size_t x, size_t y)
-//{
-//    if (x > y)
-//        return x;
-//    else
-//        return y;
-//}
-
-/*!
- * \struct alloc_node A single node of the allocation linked list.
- * \param nbytes The number of bytes to be allocated.
- * \property val  A pointer to struct cstr.
- * \property next A pointer to the next node in the allocation list.
- */
-struct alloc_node
+static LIBSTRING_INLINE size_t __cstr_max(size_t x, size_t y)
 {
-    cstr_t            * val;
-    struct alloc_node * next;
-};
+    if (x > y)
+        return x;
+    else
+        return y;
+}
 
-//! We keep a simple linked list of heap allocations as to allow for string_free_all()
-struct alloc_node * alloc_list_head = NULL;
+//! **** Word-at-a-time (SWAR) helpers **** !//
+//! These let us look at sizeof(size_t) bytes per step without depending on any SIMD header.
+
+//! LIBSTRING_ONES is 0x0101...01 and LIBSTRING_HIGHS is 0x8080...80, whatever the word size.
+#define LIBSTRING_WORD_SIZE sizeof(size_t)
+#define LIBSTRING_ONES      ((size_t) -1 / 0xFF)
+#define LIBSTRING_HIGHS     (LIBSTRING_ONES * 0x80)
 
 //!
-//! \brief string_alloc Allocates memory for a cstr_t * and adds it to the allocation list.
-//! \param nbytes       The number of bytes to be allocated.
-//! \return             Returns a new cstr_t* allocated within the alloc. list.
+//! \brief __load_word Reads an unaligned machine word from a char array.
+//! \param src         Where to read the word from. At least LIBSTRING_WORD_SIZE bytes must be readable.
+//! \return            The word read.
 //!
-cstr_t * string_alloc (size_t nbytes)
+static LIBSTRING_INLINE size_t __load_word(const char * src)
 {
-    if (!alloc_list_head)   // If the list's head hasn't been initialized
-    {
-        alloc_list_head                = __malloc(sizeof(struct alloc_node));
-        alloc_list_head->val           = __malloc(sizeof(struct cstr));
-        alloc_list_head->val->value    = __malloc(nbytes + 1);
-        alloc_list_head->val->size     = nbytes-1;  //! Remove one from nbytes because it includes the NULL-terminator.
-        alloc_list_head->val->reserved = nbytes;
-        alloc_list_head->next          = NULL;
-        return alloc_list_head->val;
-    }
+    size_t word;
+#ifdef __GNUC__
+    __builtin_memcpy(&word, src, sizeof word);
+#else
+    __memcpy((char *) &word, src, sizeof word);
+#endif
+    return word;
+}
 
-    struct alloc_node * current = alloc_list_head;
-    while (current->next)
-        current = current->next;
+//!
+//! \brief __store_word Writes a machine word to an (possibly unaligned) char array.
+//! \param dest         Where to write the word to. At least LIBSTRING_WORD_SIZE bytes must be writable.
+//! \param word         The word to be written.
+//!
+static LIBSTRING_INLINE void __store_word(char * dest, size_t word)
+{
+#ifdef __GNUC__
+    __builtin_memcpy(dest, &word, sizeof word);
+#else
+    __memcpy(dest, (const char *) &word, sizeof word);
+#endif
+}
 
-    current->next       = __malloc(sizeof(struct alloc_node));
-    current->next->val  = __malloc(sizeof(struct cstr));
-    current->next->val->value = __malloc(nbytes + 1);
-    current->next->val->size = nbytes-1;
-    current->next->val->reserved = nbytes;
-    current->next->next = NULL;
-    return current->next->val;
+//!
+//! \brief __swar_ascii_range Finds the bytes of an all-ASCII word that lie within [lo, hi].
+//! \param word               A word with no high bit set in any of its bytes.
+//! \param lo                 Lower bound of the range (ASCII).
+//! \param hi                 Upper bound of the range (ASCII).
+//! \return                   A word with 0x20 in every byte within the range and 0x00 everywhere else.
+//! XOR-ing the result into `word` flips the case of every letter in the range.
+//!
+static LIBSTRING_INLINE size_t __swar_ascii_range(size_t word, unsigned char lo, unsigned char hi)
+{
+    size_t at_least_lo = word + LIBSTRING_ONES * (size_t) (0x80 - lo);
+    size_t above_hi    = word + LIBSTRING_ONES * (size_t) (0x7F - hi);
+    return ((at_least_lo & ~above_hi) & LIBSTRING_HIGHS) >> 2;
 }
 
 //!
-//! \brief string_free_all Frees all heap memory allocated by libstring.
+//! \brief __swar_little_endian Tells whether the first byte of a char array ends up in the lowest byte of a word loaded by __load_word.
+//! The code that moves bytes around within a word is written for that case, and left to scalar loops otherwise.
 //!
-void string_free_all (void)
+static LIBSTRING_INLINE bool __swar_little_endian(void)
 {
-    struct alloc_node * current = alloc_list_head;
-    while (current)
-    {
-        struct alloc_node * temp = current;
-        current = current->next;
-        free(temp->val->value);
-        free(temp->val);
-        free(temp);
-    }
-    current = NULL;
-    alloc_list_head = NULL;
+    size_t probe = 1;    //! A constant to the compiler, which then drops whichever branch depends on it
+    return *(const char *) &probe == 1;
 }
 
-static char * __strtok_wrapper(char *str, char *delim)
+//!
+//! \brief __swar_zero_bytes Finds the zero bytes of a word.
+//! \return                  A word with 0x80 in every byte that is zero in `word` and 0x00 everywhere else.
+//! Unlike the usual `(word - ONES) & ~word & HIGHS`, this has no false positives, so every marked byte can be trusted.
+//!
+static LIBSTRING_INLINE size_t __swar_zero_bytes(size_t word)
 {
-    static char *last;
-    return __strtok(str, delim, &last);
+    size_t lows = LIBSTRING_HIGHS - LIBSTRING_ONES;    //! 0x7F in every byte
+    return ~(((word & lows) + lows) | word | lows);
 }
 
-bool sanity_check(cstr_t * str)
+//!
+//! \brief __swar_first_marked Finds the first (lowest addressed) marked byte of a word loaded by __load_word.
+//! \param marks               A non-zero word with only the high bits of its bytes possibly set.
+//! \return                    The index of that byte.
+//!
+static LIBSTRING_INLINE size_t __swar_first_marked(size_t marks)
 {
-    if (!str)
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (size_t) __builtin_ctzll((unsigned long long) marks) / 8;
+#else
+    size_t i;
+    char bytes[sizeof(size_t)];
+    __store_word(bytes, marks);
+    for (i = 0; !bytes[i]; i++)
     {
-        fprintf(stderr, "In sanity_check: the given string is NULL.\n");
-        return false;
     }
+    return i;
+#endif
+}
 
-    if (str->size > str->reserved)
+//!
+//! \brief __swar_last_marked Finds the last (highest addressed) marked byte of a word loaded by __load_word.
+//! \param marks              A non-zero word with only the high bits of its bytes possibly set.
+//! \return                   The index of that byte.
+//!
+static LIBSTRING_INLINE size_t __swar_last_marked(size_t marks)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return sizeof(unsigned long long) - 1 - (size_t) __builtin_clzll((unsigned long long) marks) / 8;
+#else
+    size_t i;
+    char bytes[sizeof(size_t)];
+    __store_word(bytes, marks);
+    for (i = sizeof(size_t) - 1; !bytes[i]; i--)
     {
-        //! str->size would only be bigger than str->reserved
-        //! if str is uninitialized
-        fprintf(stderr, "In sanity_check: the given string is probably not initialized.\n");
-        return false;
     }
-
-    return true;
+    return i;
+#endif
 }
 
-LIBSTRING_INLINE char * string_first_token(char * str, char * delim)
+//!
+//! \brief __swar_count_marked Counts the marked bytes of a word.
+//! \param marks               A word with only the high bits of its bytes possibly set.
+//! \return                    How many of them are set.
+//! Moving every mark to the low bit of its byte and multiplying by ONES adds all the bytes up in the top one.
+//!
+static LIBSTRING_INLINE size_t __swar_count_marked(size_t marks)
 {
-    return __strtok_wrapper(str, delim);
+    return ((marks >> 7) * LIBSTRING_ONES) >> ((LIBSTRING_WORD_SIZE - 1) * 8);
 }
 
-LIBSTRING_INLINE char * string_get_token(char * delim)
+/*!
+ * \struct alloc_node A single node of the allocation linked list.
+ * \property val  The string itself. It comes first, so that a cstr_t * is also a pointer to its node.
+ * \property prev A pointer to the previous node in the allocation list, so that string_free() can unlink in O(1).
+ * \property next A pointer to the next node in the allocation list.
+ */
+struct alloc_node
 {
-    return __strtok_wrapper(NULL, delim);
-}
+    cstr_t              val;
+    struct alloc_node * prev;
+    struct alloc_node * next;
+};
+
+//! We keep a simple linked list of heap allocations as to allow for string_free_all()
+struct alloc_node * alloc_list_head = NULL;
 
 //!
-//! \brief string_to_lower_case Alters a string to contain only lower-case characters.
-//! \param origin               The string whose value will be converted to lower-case characters. This parameters does not get modified.
-//! \return                     A brand new cstr_t * that contains the altered value.
+//! \brief __memchr Finds the first occurrence of a char within the first `n` elements of a char array.
+//! \param str      The char array to be searched.
+//! \param c        The char to search for.
+//! \param n        The number of elements to be searched.
+//! \return         A pointer to the occurrence, or NULL if there is none.
+//! Looks at a word at a time: XOR-ing with `c` repeated turns its occurrences into zero bytes.
 //!
-cstr_t * string_to_lower_case(cstr_t * origin)
+static const char * __memchr(const char * str, char c, size_t n)
 {
-    if (!sanity_check(origin))
+    size_t pattern = LIBSTRING_ONES * (unsigned char) c;
+
+    for (; n >= LIBSTRING_WORD_SIZE; n -= LIBSTRING_WORD_SIZE, str += LIBSTRING_WORD_SIZE)
     {
-        fprintf(stderr, "In string_to_lower_case: sanity check on `origin` failed.\n");
-        return string_init("");
+        size_t marks = __swar_zero_bytes(__load_word(str) ^ pattern);
+        if (marks)
+        {
+            return str + __swar_first_marked(marks);
+        }
     }
-
-    cstr_t* lower = string_init(origin->value);
-    __strcpy(lower->value, origin->value, origin->size);
-
-    size_t i;
-    for(i=0; i<lower->size; i++)
+    for (; n; n--, str++)
     {
-        if ((lower->value[i] >= 'A') && (lower->value[i] <= 'Z'))
+        if (*str == c)
         {
-            lower->value[i] |= ' ';
+            return str;
         }
     }
-    return lower;
+    return NULL;
 }
 
 //!
-//! \brief string_to_upper_case Alters a string to contain only upper-case characters.
-//! \param origin               The string whose value will be converted to upper-case characters. This parameters does not get modified.
-//! \return                     A brand new cstr_t * that contains the altered value.
-//! Makes use of bit manipulation to alter the ASCII values.
+//! \brief __memrchr Finds the last occurrence of a char within the first `n` elements of a char array.
+//! \return          A pointer to the occurrence, or NULL if there is none.
 //!
-cstr_t * string_to_upper_case(cstr_t * origin)
+static const char * __memrchr(const char * str, char c, size_t n)
 {
-    if (!sanity_check(origin))
+    size_t pattern = LIBSTRING_ONES * (unsigned char) c;
+
+    for (; n >= LIBSTRING_WORD_SIZE; n -= LIBSTRING_WORD_SIZE)
     {
-        fprintf(stderr, "In string_to_lower_case: sanity check on `origin` failed.\n");
-        return string_init("");
+        size_t marks = __swar_zero_bytes(__load_word(str + n - LIBSTRING_WORD_SIZE) ^ pattern);
+        if (marks)
+        {
+            return str + n - LIBSTRING_WORD_SIZE + __swar_last_marked(marks);
+        }
     }
-
-    cstr_t* upper;
-    upper = string_init(origin->value);
-    __strcpy(upper->value, origin->value, origin->size);
-
-    size_t i;
-    for(i=0; i<upper->size; i++)
+    while (n--)
     {
-        if ((upper->value[i] >= 'a') && (upper->value[i] <= 'z'))
+        if (str[n] == c)
         {
-            upper->value[i] &= '_';
+            return str + n;
         }
     }
-    return upper;
+    return NULL;
 }
 
-
 //!
-//! \brief __strset
-//! \param dest
-//! \param ch
-//! \param n
-//! \return
+//! \brief __count_char Counts the occurrences of a char within the first `n` elements of a char array.
+//! \return             How many there are.
 //!
-void * __strset(char * dest, char ch, size_t n)
-{
-    if (n) {
-        char *d = dest;
-        do {
-            *d++ = ch;
-        } while (--n);
-    }
-    return dest;
-}
-
-char * __strcat(char *dst, const char *src)
- {
-     char *ret = dst;
-
-     for (; *dst; ++dst);
-     while ((*dst++ = *src++) != '\0');
-     return ret;
-}
-
-// TODO: change to use __strcpy
-static char * __strlcpy(char *dst, const char *src)
-{
-    char *save = dst;
-    for (; (*dst = *src) != '\0'; ++src, ++dst);
-    return save;
-}
-
-void string_replace(cstr_t * str, char * old_val, const char * new_val)
+static size_t __count_char(const char * str, char c, size_t n)
 {
-    // TODO: check for overflows here
+    size_t pattern = LIBSTRING_ONES * (unsigned char) c, count = 0;
 
-    if (!sanity_check(str))
+    for (; n >= LIBSTRING_WORD_SIZE; n -= LIBSTRING_WORD_SIZE, str += LIBSTRING_WORD_SIZE)
     {
-        fprintf(stderr, "In string_replace: sanity check on `str` failed.\n");
-        return;
+        count += __swar_count_marked(__swar_zero_bytes(__load_word(str) ^ pattern));
     }
-
-    char * src = str->value;
-    char *p = __strstr(src, old_val);
-    do
+    for (; n; n--, str++)
     {
-        if(p)   // If the substring was found
-        {
-            char buf[1024] = {'\0'};
-
-            if(src == p)
-            {
-                __strlcpy(buf,new_val);
-                __strcat(buf,p+__strlen(old_val));
-            }
-            else
-            {
-                __strcpy(buf,src,__strlen(src) - __strlen(p));
-                __strcat(buf,new_val);
-                __strcat(buf,p+__strlen(old_val));
-            }
-
-            __strset(src,'\0', __strlen(src));
-            __strlcpy(src, buf);
-        }
-
-    }while(p && (p = __strstr(src, old_val)));
+        count += *str == c;
+    }
+    return count;
 }
 
 //!
-//! \brief string_init Initializes a new cstr_t *.
-//! \param origin      The char array to be the value of the new string.
-//! \return            A brand new cstr_t *.
+//! \brief __memeq_words Word-at-a-time counterpart of __memeq, for the comparisons whose length is known.
 //!
-cstr_t * string_init(const char * origin)
+static bool __memeq_words(const char * str1, const char * str2, size_t size)
 {
-    if (!origin || origin[0] == '\0')
+    for (; size >= LIBSTRING_WORD_SIZE; size -= LIBSTRING_WORD_SIZE, str1 += LIBSTRING_WORD_SIZE, str2 += LIBSTRING_WORD_SIZE)
     {
-        cstr_t * new = string_alloc(1);
-        new->value[0] = '\0';
-        return new;
+        if (__load_word(str1) != __load_word(str2))
+        {
+            return false;
+        }
     }
-    cstr_t * new = string_alloc(__strlen(origin)+1);
-    __strcpy(new->value, origin, __strlen(origin));
-    return new;
+    for (; size; size--)
+    {
+        if (*str1++ != *str2++)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 //!
-//! \brief string_update  Updates the value of an cstr_t *. Increases its memory reservation if needed.
-//! \param str            The cstr_t * to be modified.
-//! \param new_val        The new char array value.
-//! \return               The new string's size.
+//! \brief __memmem Finds the first occurrence of a char array within another, without relying on NUL-terminators.
+//! \param str      The char array to be searched.
+//! \param len      Its length.
+//! \param find     The char array to search for.
+//! \param find_len Its length.
+//! \return         A pointer to the occurrence within `str`, or NULL if there is none.
+//! Candidates are found by scanning for the first char with __memchr, and the last char is checked before
+//! comparing the rest.
 //!
-size_t string_update(cstr_t * str, const char * new_val)
+static const char * __memmem(const char * str, size_t len, const char * find, size_t find_len)
 {
-    if(!sanity_check(str))
+    const char * end;
+
+    if (!find_len)
     {
-        fprintf(stderr, "In string_update: sanity check on `str` failed.\n");
+        return str;
     }
-
-    if (!new_val)
+    if (find_len > len)
     {
-        return 0;
+        return NULL;
     }
 
-    size_t new_string_len = new_val[0] == '\0' ? 0 : __strlen(new_val);
-    if (new_string_len > str->reserved)
+    end = str + (len - find_len) + 1;   //! One past the last position where `find` would fit
+    while ((str = __memchr(str, find[0], (size_t) (end - str))))
     {
-        if (!string_reserve(str, new_string_len+1))
+        if (str[find_len - 1] == find[find_len - 1] && __memeq((char *) str + 1, (char *) find + 1, find_len - 1))
         {
-            fprintf(stderr, "In string_replace: string_reserve(str, %zu) failed.", new_string_len+1);
-            return 0;
+            return str;
         }
+        str++;
     }
+    return NULL;
+}
 
-    if (new_val[0] == '\0')
-    {
-        str->value[0] = '\0';
-    } else {
-        __strcpy(str->value, new_val, new_string_len);
-    }
-    str->size = new_string_len;
-    return new_string_len;
+//! **** Statistics (only with -DLIBSTRING_STATS) **** !//
+
+#ifdef LIBSTRING_STATS
+#   include <time.h>
+
+//! Counters that can't be recomputed from the allocation list when a snapshot is taken.
+static struct string_stats lstats;
+static size_t              reserved_now = 0;
+
+//!
+//! \brief __stats_cycles Reads a cheap, monotonic cycle (or tick) counter.
+//!
+static LIBSTRING_INLINE unsigned long long __stats_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned int lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long) hi << 32) | lo;
+#elif defined(__GNUC__) && defined(__aarch64__)
+    unsigned long long ticks;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return ticks;
+#else
+    return (unsigned long long) clock();
+#endif
 }
 
 //!
-//! \brief string_contains
-//! \param str1
-//! \param str2
-//! \return
+//! \brief __stats_reserved Accounts for a string's reservation going from `before` to `after` bytes.
 //!
-bool string_contains(cstr_t * str1, const char * str2)
+static void __stats_reserved(size_t before, size_t after)
 {
-    if (!sanity_check(str1))
+    reserved_now = reserved_now - before + after;
+    if (reserved_now > lstats.peak_bytes_reserved)
     {
-        fprintf(stderr, "In string_contains: sanity check on `str1` failed.\n");
-        return false;
+        lstats.peak_bytes_reserved = reserved_now;
     }
+}
 
-    if (str1->size < __strlen(str2))
-    {
-        //! str2 is bigger than str1, so it can't be a substring.
-        return false;
+/*!
+ * \struct stats_scope Tracks a single call to an instrumented function.
+ * \property fn    Which function is being called.
+ * \property start Cycle counter when the call started.
+ */
+struct stats_scope
+{
+    enum string_stat_fn fn;
+    unsigned long long  start;
+};
+
+static LIBSTRING_INLINE struct stats_scope __stats_scope_begin(enum string_stat_fn fn)
+{
+    struct stats_scope scope;
+    lstats.calls[fn]++;
+    scope.fn    = fn;
+    scope.start = __stats_cycles();
+    return scope;
+}
+
+static LIBSTRING_INLINE void __stats_scope_end(struct stats_scope * scope)
+{
+    unsigned long long elapsed = __stats_cycles() - scope->start;
+    size_t bucket = 0;
+    while (elapsed >>= 1)
+    {
+        bucket++;
+    }
+    lstats.cycles[scope->fn][__cstr_min(bucket, STRING_STATS_BUCKETS - 1)]++;
+}
+
+#   ifdef __GNUC__
+        //! The cleanup attribute closes the scope on every return path of the instrumented function.
+#       define LIBSTRING_STATS_SCOPE(fn) \
+            struct stats_scope __stats_scope __attribute__((cleanup(__stats_scope_end))) = __stats_scope_begin(fn);
+#   else
+        //! Without it, only calls get counted.
+#       undef  LIBSTRING_STATS_SCOPE
+#       define LIBSTRING_STATS_SCOPE(fn) lstats.calls[fn]++;
+#   endif
+#   define LIBSTRING_STATS_RESERVED(before, after) __stats_reserved((before), (after))
+#   define LIBSTRING_STATS_REALLOC()               (lstats.reallocs++)
+#else
+#   undef  LIBSTRING_STATS_SCOPE
+#   undef  LIBSTRING_STATS_RESERVED
+#   undef  LIBSTRING_STATS_REALLOC
+#   define LIBSTRING_STATS_SCOPE(fn)
+#   define LIBSTRING_STATS_RESERVED(before, after) ((void) 0)
+#   define LIBSTRING_STATS_REALLOC()               ((void) 0)
+#endif
+
+//! **** Reference-counted buffers **** !//
+//! The buffer of every string created by libstring is preceded by a reference count, so that
+//! copies can share it until one of them gets modified (copy-on-write). Such strings have the
+//! STRING_OWNED flag. Strings without it (e.g. put together by hand) are never shared nor written to.
+
+#define LIBSTRING_BUF_HEADER sizeof(size_t)
+
+static LIBSTRING_INLINE size_t * __buf_refs(const char * value)
+{
+    return (size_t *) (value - LIBSTRING_BUF_HEADER);
+}
+
+//!
+//! \brief __buf_alloc Allocates a buffer for `capacity` characters plus the NUL-terminator, with a reference count of 1.
+//! \return            The buffer, or NULL if allocation failed.
+//!
+static char * __buf_alloc(size_t capacity)
+{
+    char * block = __malloc(LIBSTRING_BUF_HEADER + capacity + 1);
+    if (!block)
+    {
+        return NULL;
+    }
+    *(size_t *) block = 1;
+    return block + LIBSTRING_BUF_HEADER;
+}
+
+//!
+//! \brief __buf_release Drops a reference to a buffer, freeing it if it was the last one.
+//! \param value         The buffer.
+//! \param capacity      The capacity it was allocated with.
+//!
+static void __buf_release(char * value, size_t capacity)
+{
+    if (!--*__buf_refs(value))
+    {
+        __free(value - LIBSTRING_BUF_HEADER, LIBSTRING_BUF_HEADER + capacity + 1);
+    }
+}
+
+//!
+//! \brief __string_resize_buffer Gives `str` a buffer of its own with room for `capacity` characters.
+//! \param str                    An owned string whose size is not bigger than `capacity`.
+//! \param capacity               The new capacity.
+//! \param keep                   Whether the current value has to be carried over.
+//! \return                       False if allocation failed, in which case `str` is untouched.
+//! A buffer that is not shared gets reallocated, a shared one gets copied.
+//!
+static bool __string_resize_buffer(cstr_t * str, size_t capacity, bool keep)
+{
+    char * value;
+
+    if (*__buf_refs(str->value) == 1)
+    {
+        char * block = __realloc(str->value - LIBSTRING_BUF_HEADER, LIBSTRING_BUF_HEADER + str->reserved + 1,
+                                 LIBSTRING_BUF_HEADER + capacity + 1);
+        if (!block)
+        {
+            return false;
+        }
+        value = block + LIBSTRING_BUF_HEADER;
+    } else
+    {
+        value = __buf_alloc(capacity);
+        if (!value)
+        {
+            return false;
+        }
+        if (keep)
+        {
+            __memcpy(value, str->value, str->size + 1);
+        }
+        __buf_release(str->value, str->reserved);
+    }
+
+    LIBSTRING_STATS_REALLOC();
+    LIBSTRING_STATS_RESERVED(str->reserved, capacity);
+    str->value    = value;
+    str->reserved = capacity;
+    return true;
+}
+
+//!
+//! \brief __string_make_writable Prepares `str` to be modified: copies its buffer if it is shared and grows it if needed.
+//! \param str                    The string about to be modified.
+//! \param capacity               How many characters the modification needs room for.
+//! \param keep                   Whether the modification needs the current value.
+//! \param where                  What to report on failure, e.g. "In string_x: `str` could not be written to."
+//! \return                       False if `str` can't be written to (not owned by libstring, or out of memory).
+//!
+static bool __string_make_writable(cstr_t * str, size_t capacity, bool keep, const char * where)
+{
+    if (!(str->flags & STRING_OWNED))
+    {
+        __string_error(STRING_ERR_READONLY, where);
+        return false;
+    }
+
+    if (*__buf_refs(str->value) == 1 && capacity <= str->reserved)
+    {
+        return true;    //! The common case: nothing to do
+    }
+
+    if (!__string_resize_buffer(str, __cstr_max(capacity, str->reserved), keep))
+    {
+        __string_error(STRING_ERR_ALLOC, where);
+        return false;
+    }
+    return true;
+}
+
+//!
+//! \brief __string_register Adds a string to the allocation list.
+//! \param value             An owned buffer. The new string takes over the caller's reference to it.
+//! \param size              The size of the string.
+//! \param reserved          The capacity of `value`.
+//! \return                  The new string, or NULL if allocation failed.
+//!
+static cstr_t * __string_register(char * value, size_t size, size_t reserved)
+{
+    struct alloc_node * node = __malloc(sizeof(struct alloc_node));
+    if (!node)
+    {
+        return NULL;
+    }
+
+    node->val.value    = value;
+    node->val.size     = size;
+    node->val.reserved = reserved;
+    node->val.flags    = STRING_OWNED;
+    node->prev         = NULL;
+    node->next         = alloc_list_head;   //! New strings go in front, so this doesn't need to walk the list
+    if (alloc_list_head)
+    {
+        alloc_list_head->prev = node;
+    }
+    alloc_list_head    = node;
+    LIBSTRING_STATS_RESERVED(0, reserved);
+    return &node->val;
+}
+
+//!
+//! \brief string_alloc Allocates memory for a cstr_t * and adds it to the allocation list.
+//! \param nbytes       The number of bytes to be allocated.
+//! \return             Returns a new cstr_t* allocated within the alloc. list.
+//!
+cstr_t * string_alloc (size_t nbytes)
+{
+    char * value = __buf_alloc(nbytes);
+    cstr_t * str;
+
+    if (!value)
+    {
+        return NULL;
+    }
+
+    str = __string_register(value, nbytes-1, nbytes);   //! Remove one from nbytes because it includes the NULL-terminator.
+    if (!str)
+    {
+        __buf_release(value, nbytes);
+    }
+    return str;
+}
+
+//!
+//! \brief string_free Frees a single string allocated by libstring.
+//! \param str         A string returned by libstring (not a literal nor a string put together by hand), or NULL.
+//! The string's buffer is only freed once no copy shares it anymore.
+//!
+void string_free(cstr_t * str)
+{
+    struct alloc_node * node = (struct alloc_node *) str;
+
+    if (!str)
+    {
+        return;
+    }
+
+    if (node->prev)
+    {
+        node->prev->next = node->next;
+    } else
+    {
+        alloc_list_head = node->next;
+    }
+    if (node->next)
+    {
+        node->next->prev = node->prev;
+    }
+
+    LIBSTRING_STATS_RESERVED(str->reserved, 0);
+    __buf_release(str->value, str->reserved);
+    __free(node, sizeof(struct alloc_node));
+}
+
+//!
+//! \brief string_free_all Frees all heap memory allocated by libstring.
+//!
+void string_free_all (void)
+{
+    struct alloc_node * current = alloc_list_head;
+    while (current)
+    {
+        struct alloc_node * temp = current;
+        current = current->next;
+        LIBSTRING_STATS_RESERVED(temp->val.reserved, 0);
+        __buf_release(temp->val.value, temp->val.reserved);
+        __free(temp, sizeof(struct alloc_node));
+    }
+    current = NULL;
+    alloc_list_head = NULL;
+}
+
+//!
+//! \brief string_stats_snapshot Copies the current allocation and call statistics.
+//! \param out                   Where to write the statistics to.
+//! \return                      False if libstring was built without LIBSTRING_STATS, in which case `out` is untouched.
+//! Live strings and their reserved/used bytes are counted by walking the allocation list, so
+//! keeping them up to date costs nothing on the hot paths.
+//!
+bool string_stats_snapshot(string_stats_t * out)
+{
+#ifdef LIBSTRING_STATS
+    struct alloc_node * current;
+
+    if (!out)
+    {
+        return false;
+    }
+
+    *out = lstats;
+    out->live_strings   = 0;
+    out->bytes_reserved = 0;
+    out->bytes_used     = 0;
+    for (current = alloc_list_head; current; current = current->next)
+    {
+        out->live_strings++;
+        out->bytes_reserved += current->val.reserved;
+        out->bytes_used     += current->val.size;
+    }
+    return true;
+#else
+    (void) out;
+    return false;
+#endif
+}
+
+//!
+//! \brief string_stats_reset Zeroes all counters and histograms. The peak is set to the current reservation.
+//!
+void string_stats_reset(void)
+{
+#ifdef LIBSTRING_STATS
+    struct string_stats empty = { 0 };
+    lstats = empty;
+    lstats.peak_bytes_reserved = reserved_now;
+#endif
+}
+
+//!
+//! \brief string_set_allocator Routes every allocation made by libstring through `hooks`.
+//! \param hooks                The allocator to be used, or NULL to go back to malloc, realloc and free.
+//! \return                     False if anything allocated by libstring is still alive (strings, split arrays,
+//!                             regexes or indexes), as it would end up freed by the wrong allocator.
+//!
+bool string_set_allocator(const string_allocator_t * hooks)
+{
+    if (live_blocks)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_set_allocator: free every string, split array, regex and index before changing allocators.");
+        return false;
+    }
+
+    if (hooks)
+    {
+        allocator = *hooks;
+    } else
+    {
+        allocator.allocate   = __system_allocate;
+        allocator.reallocate = __system_reallocate;
+        allocator.deallocate = __system_deallocate;
+        allocator.context    = NULL;
+    }
+    return true;
+}
+
+//! **** Size-class pool allocator **** !//
+
+//! Block sizes grow by about 1.5x, so at most a third of a block is wasted. Anything bigger than the
+//! last class goes straight to malloc.
+static const size_t pool_class_sizes[] =
+{
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+#define LIBSTRING_POOL_CLASSES   LIBSTRING_TABLE_LEN(pool_class_sizes)
+#define LIBSTRING_POOL_MAX_BLOCK 2048
+#define LIBSTRING_POOL_SLAB_SIZE 65536
+#define LIBSTRING_POOL_ALIGN     16
+
+/*!
+ * \struct pool_block A free block, threaded into its size class' free list.
+ */
+struct pool_block
+{
+    struct pool_block * next;
+};
+
+/*!
+ * \struct pool_slab A chunk of memory carved into blocks of a single size class.
+ * \property next The previously allocated slab, so that they can all be freed by string_pool_destroy().
+ */
+struct pool_slab
+{
+    struct pool_slab * next;
+};
+
+struct string_pool
+{
+    struct pool_block * free_lists[LIBSTRING_TABLE_LEN(pool_class_sizes)];
+    struct pool_slab  * slabs;
+    unsigned char       class_of[LIBSTRING_POOL_MAX_BLOCK / LIBSTRING_POOL_ALIGN + 1];
+};
+
+//!
+//! \brief __pool_class Finds the size class for a request.
+//! \return             The index of the smallest class that fits `size`, or LIBSTRING_POOL_CLASSES if none does.
+//!
+static LIBSTRING_INLINE size_t __pool_class(const struct string_pool * pool, size_t size)
+{
+    if (size > LIBSTRING_POOL_MAX_BLOCK)
+    {
+        return LIBSTRING_POOL_CLASSES;
+    }
+    return pool->class_of[(size + LIBSTRING_POOL_ALIGN - 1) / LIBSTRING_POOL_ALIGN];
+}
+
+//!
+//! \brief __pool_refill Carves a new slab into free blocks of the given class.
+//! \return              False if the slab could not be allocated.
+//!
+static bool __pool_refill(struct string_pool * pool, size_t class)
+{
+    size_t block_size = pool_class_sizes[class];
+    size_t count      = (LIBSTRING_POOL_SLAB_SIZE - LIBSTRING_POOL_ALIGN) / block_size;
+    char * slab       = malloc(LIBSTRING_POOL_ALIGN + count * block_size);
+    char * block;
+
+    if (!slab)
+    {
+        return false;
+    }
+    ((struct pool_slab *) slab)->next = pool->slabs;
+    pool->slabs = (struct pool_slab *) slab;
+
+    //! Thread the blocks in address order, so that consecutive allocations are adjacent
+    for (block = slab + LIBSTRING_POOL_ALIGN + (count - 1) * block_size; block >= slab + LIBSTRING_POOL_ALIGN; block -= block_size)
+    {
+        ((struct pool_block *) block)->next = pool->free_lists[class];
+        pool->free_lists[class] = (struct pool_block *) block;
+    }
+    return true;
+}
+
+static void * __pool_allocate(void * context, size_t size)
+{
+    struct string_pool * pool = context;
+    size_t class = __pool_class(pool, size);
+    struct pool_block * block;
+
+    if (class == LIBSTRING_POOL_CLASSES)
+    {
+        return malloc(size);
+    }
+
+    if (!pool->free_lists[class] && !__pool_refill(pool, class))
+    {
+        return NULL;
+    }
+    block = pool->free_lists[class];
+    pool->free_lists[class] = block->next;
+    return block;
+}
+
+static void __pool_deallocate(void * context, void * ptr, size_t size)
+{
+    struct string_pool * pool = context;
+    size_t class = __pool_class(pool, size);
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (class == LIBSTRING_POOL_CLASSES)
+    {
+        free(ptr);
+        return;
+    }
+    ((struct pool_block *) ptr)->next = pool->free_lists[class];
+    pool->free_lists[class] = ptr;
+}
+
+static void * __pool_reallocate(void * context, void * ptr, size_t old_size, size_t new_size)
+{
+    struct string_pool * pool = context;
+    size_t old_class = __pool_class(pool, old_size);
+    size_t new_class = __pool_class(pool, new_size);
+    void * new_ptr;
+
+    if (old_class == new_class)
+    {
+        //! Either the block is already big enough, or both sizes belong to malloc
+        return old_class == LIBSTRING_POOL_CLASSES ? realloc(ptr, new_size) : ptr;
+    }
+
+    new_ptr = __pool_allocate(context, new_size);
+    if (!new_ptr)
+    {
+        return NULL;
+    }
+    __memcpy(new_ptr, ptr, __cstr_min(old_size, new_size));
+    __pool_deallocate(context, ptr, old_size);
+    return new_ptr;
+}
+
+//!
+//! \brief string_pool_create Creates a pool allocator with size classes tuned for short strings.
+//! \return                   The new pool, or NULL if it could not be allocated.
+//! The pool itself and its slabs are always allocated with malloc. A pool is not thread-safe.
+//!
+string_pool_t * string_pool_create(void)
+{
+    struct string_pool * pool = malloc(sizeof(struct string_pool));
+    size_t i, class = 0;
+
+    if (!pool)
+    {
+        __string_error(STRING_ERR_ALLOC, "In string_pool_create: malloc failed.");
+        return NULL;
+    }
+
+    for (i = 0; i < LIBSTRING_POOL_CLASSES; i++)
+    {
+        pool->free_lists[i] = NULL;
+    }
+    pool->slabs = NULL;
+
+    for (i = 0; i < LIBSTRING_TABLE_LEN(pool->class_of); i++)
+    {
+        while (pool_class_sizes[class] < i * LIBSTRING_POOL_ALIGN)
+        {
+            class++;
+        }
+        pool->class_of[i] = (unsigned char) class;
+    }
+    return pool;
+}
+
+//!
+//! \brief string_pool_destroy Releases all memory held by a pool.
+//! Every block handed out by the pool becomes invalid, so call string_free_all() first.
+//!
+void string_pool_destroy(string_pool_t * pool)
+{
+    struct pool_slab * slab;
+
+    if (!pool)
+    {
+        return;
+    }
+
+    slab = pool->slabs;
+    while (slab)
+    {
+        struct pool_slab * next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pool);
+}
+
+//!
+//! \brief string_pool_allocator Returns the hooks to be given to string_set_allocator() to allocate from `pool`.
+//!
+string_allocator_t string_pool_allocator(string_pool_t * pool)
+{
+    string_allocator_t hooks;
+    hooks.allocate   = __pool_allocate;
+    hooks.reallocate = __pool_reallocate;
+    hooks.deallocate = __pool_deallocate;
+    hooks.context    = pool;
+    return hooks;
+}
+
+static char * __strtok_wrapper(char *str, char *delim)
+{
+    static char *last;
+    return __strtok(str, delim, &last);
+}
+
+//!
+//! \brief sanity_check Verifies that `str` looks like a valid, initialized string, reporting an error if not.
+//! \param str          The string to be checked.
+//! \param where        What to report on failure, e.g. "In string_x: sanity check on `str` failed."
+//! \return             True if `str` passed the check.
+//! Use it through LIBSTRING_SANITY_CHECK, which turns it into an assertion on release builds.
+//!
+bool sanity_check(cstr_t * str, const char * where)
+{
+    if (!str)
+    {
+        __string_error(STRING_ERR_NULL, where);
+        return false;
+    }
+
+    if (str->size > str->reserved)
+    {
+        //! str->size would only be bigger than str->reserved
+        //! if str is uninitialized
+        __string_error(STRING_ERR_UNINITIALIZED, where);
+        return false;
+    }
+
+    return true;
+}
+
+//!
+//! \brief string_last_error Returns the last error reported by libstring on the calling thread.
+//! Like errno, it is only set when something fails; use string_clear_error() to reset it.
+//!
+enum string_error string_last_error(void)
+{
+    return last_error;
+}
+
+//!
+//! \brief string_clear_error Resets the calling thread's last error to STRING_OK.
+//!
+void string_clear_error(void)
+{
+    last_error = STRING_OK;
+}
+
+//!
+//! \brief string_set_error_handler Installs a function to be called on every error.
+//! \param handler                  The handler, or NULL to restore the default one.
+//! \param context                  Passed as is to `handler`.
+//! The default handler prints to stderr, except on release builds, where it does nothing.
+//!
+void string_set_error_handler(string_error_handler_t handler, void * context)
+{
+    error_handler         = handler ? handler : LIBSTRING_DEFAULT_ERROR_HANDLER;
+    error_handler_context = handler ? context : NULL;
+}
+
+//!
+//! \brief string_error_description Returns a short, static description of an error code.
+//!
+const char * string_error_description(enum string_error error)
+{
+    switch (error)
+    {
+        case STRING_OK:                return "no error";
+        case STRING_ERR_NULL:          return "the given string is NULL";
+        case STRING_ERR_UNINITIALIZED: return "the given string is probably not initialized";
+        case STRING_ERR_ALLOC:         return "memory allocation failed";
+        case STRING_ERR_RANGE:         return "argument out of range";
+        case STRING_ERR_READONLY:      return "the string does not own its buffer";
+    }
+    return "unknown error";
+}
+
+LIBSTRING_INLINE char * string_first_token(char * str, char * delim)
+{
+    return __strtok_wrapper(str, delim);
+}
+
+LIBSTRING_INLINE char * string_get_token(char * delim)
+{
+    return __strtok_wrapper(NULL, delim);
+}
+
+//! **** Unicode simple case mapping **** !//
+
+/*!
+ * \struct case_range A run of code points sharing the same case mapping.
+ * \property lo     First code point of the run.
+ * \property hi     Last code point of the run.
+ * \property delta  What has to be added to a code point of the run to map it.
+ * \property stride 1 if every code point of the run maps, 2 if only lo, lo+2, lo+4, ... do
+ *                  (upper- and lower-case letters interleaved, as in most of Latin Extended).
+ */
+struct case_range
+{
+    unsigned long lo;
+    unsigned long hi;
+    long          delta;
+    unsigned char stride;
+};
+
+//! Generated by tools/gen-case-tables.py from the Unicode 14.0.0 character database, do not edit by hand.
+
+//! Simple lower-case mappings (UnicodeData.txt field 13) outside of ASCII. Must be kept sorted.
+static const struct case_range lower_table[] =
+{
+    { 0x00C0, 0x00D6,    32, 1 }, { 0x00D8, 0x00DE,    32, 1 }, { 0x0100, 0x012E,     1, 2 },
+    { 0x0130, 0x0130,  -199, 1 }, { 0x0132, 0x0136,     1, 2 }, { 0x0139, 0x0147,     1, 2 },
+    { 0x014A, 0x0176,     1, 2 }, { 0x0178, 0x0178,  -121, 1 }, { 0x0179, 0x017D,     1, 2 },
+    { 0x0181, 0x0181,   210, 1 }, { 0x0182, 0x0184,     1, 2 }, { 0x0186, 0x0186,   206, 1 },
+    { 0x0187, 0x0187,     1, 1 }, { 0x0189, 0x018A,   205, 1 }, { 0x018B, 0x018B,     1, 1 },
+    { 0x018E, 0x018E,    79, 1 }, { 0x018F, 0x018F,   202, 1 }, { 0x0190, 0x0190,   203, 1 },
+    { 0x0191, 0x0191,     1, 1 }, { 0x0193, 0x0193,   205, 1 }, { 0x0194, 0x0194,   207, 1 },
+    { 0x0196, 0x0196,   211, 1 }, { 0x0197, 0x0197,   209, 1 }, { 0x0198, 0x0198,     1, 1 },
+    { 0x019C, 0x019C,   211, 1 }, { 0x019D, 0x019D,   213, 1 }, { 0x019F, 0x019F,   214, 1 },
+    { 0x01A0, 0x01A4,     1, 2 }, { 0x01A6, 0x01A6,   218, 1 }, { 0x01A7, 0x01A7,     1, 1 },
+    { 0x01A9, 0x01A9,   218, 1 }, { 0x01AC, 0x01AC,     1, 1 }, { 0x01AE, 0x01AE,   218, 1 },
+    { 0x01AF, 0x01AF,     1, 1 }, { 0x01B1, 0x01B2,   217, 1 }, { 0x01B3, 0x01B5,     1, 2 },
+    { 0x01B7, 0x01B7,   219, 1 }, { 0x01B8, 0x01B8,     1, 1 }, { 0x01BC, 0x01BC,     1, 1 },
+    { 0x01C4, 0x01C4,     2, 1 }, { 0x01C5, 0x01C5,     1, 1 }, { 0x01C7, 0x01C7,     2, 1 },
+    { 0x01C8, 0x01C8,     1, 1 }, { 0x01CA, 0x01CA,     2, 1 }, { 0x01CB, 0x01DB,     1, 2 },
+    { 0x01DE, 0x01EE,     1, 2 }, { 0x01F1, 0x01F1,     2, 1 }, { 0x01F2, 0x01F4,     1, 2 },
+    { 0x01F6, 0x01F6,   -97, 1 }, { 0x01F7, 0x01F7,   -56, 1 }, { 0x01F8, 0x021E,     1, 2 },
+    { 0x0220, 0x0220,  -130, 1 }, { 0x0222, 0x0232,     1, 2 }, { 0x023A, 0x023A, 10795, 1 },
+    { 0x023B, 0x023B,     1, 1 }, { 0x023D, 0x023D,  -163, 1 }, { 0x023E, 0x023E, 10792, 1 },
+    { 0x0241, 0x0241,     1, 1 }, { 0x0243, 0x0243,  -195, 1 }, { 0x0244, 0x0244,    69, 1 },
+    { 0x0245, 0x0245,    71, 1 }, { 0x0246, 0x024E,     1, 2 }, { 0x0370, 0x0372,     1, 2 },
+    { 0x0376, 0x0376,     1, 1 }, { 0x037F, 0x037F,   116, 1 }, { 0x0386, 0x0386,    38, 1 },
+    { 0x0388, 0x038A,    37, 1 }, { 0x038C, 0x038C,    64, 1 }, { 0x038E, 0x038F,    63, 1 },
+    { 0x0391, 0x03A1,    32, 1 }, { 0x03A3, 0x03AB,    32, 1 }, { 0x03CF, 0x03CF,     8, 1 },
+    { 0x03D8, 0x03EE,     1, 2 }, { 0x03F4, 0x03F4,   -60, 1 }, { 0x03F7, 0x03F7,     1, 1 },
+    { 0x03F9, 0x03F9,    -7, 1 }, { 0x03FA, 0x03FA,     1, 1 }, { 0x03FD, 0x03FF,  -130, 1 },
+    { 0x0400, 0x040F,    80, 1 }, { 0x0410, 0x042F,    32, 1 }, { 0x0460, 0x0480,     1, 2 },
+    { 0x048A, 0x04BE,     1, 2 }, { 0x04C0, 0x04C0,    15, 1 }, { 0x04C1, 0x04CD,     1, 2 },
+    { 0x04D0, 0x052E,     1, 2 }, { 0x0531, 0x0556,    48, 1 }, { 0x10A0, 0x10C5,  7264, 1 },
+    { 0x10C7, 0x10C7,  7264, 1 }, { 0x10CD, 0x10CD,  7264, 1 }, { 0x13A0, 0x13EF, 38864, 1 },
+    { 0x13F0, 0x13F5,     8, 1 }, { 0x1C90, 0x1CBA, -3008, 1 }, { 0x1CBD, 0x1CBF, -3008, 1 },
+    { 0x1E00, 0x1E94,     1, 2 }, { 0x1E9E, 0x1E9E, -7615, 1 }, { 0x1EA0, 0x1EFE,     1, 2 },
+    { 0x1F08, 0x1F0F,    -8, 1 }, { 0x1F18, 0x1F1D,    -8, 1 }, { 0x1F28, 0x1F2F,    -8, 1 },
+    { 0x1F38, 0x1F3F,    -8, 1 }, { 0x1F48, 0x1F4D,    -8, 1 }, { 0x1F59, 0x1F5F,    -8, 2 },
+    { 0x1F68, 0x1F6F,    -8, 1 }, { 0x1F88, 0x1F8F,    -8, 1 }, { 0x1F98, 0x1F9F,    -8, 1 },
+    { 0x1FA8, 0x1FAF,    -8, 1 }, { 0x1FB8, 0x1FB9,    -8, 1 }, { 0x1FBA, 0x1FBB,   -74, 1 },
+    { 0x1FBC, 0x1FBC,    -9, 1 }, { 0x1FC8, 0x1FCB,   -86, 1 }, { 0x1FCC, 0x1FCC,    -9, 1 },
+    { 0x1FD8, 0x1FD9,    -8, 1 }, { 0x1FDA, 0x1FDB,  -100, 1 }, { 0x1FE8, 0x1FE9,    -8, 1 },
+    { 0x1FEA, 0x1FEB,  -112, 1 }, { 0x1FEC, 0x1FEC,    -7, 1 }, { 0x1FF8, 0x1FF9,  -128, 1 },
+    { 0x1FFA, 0x1FFB,  -126, 1 }, { 0x1FFC, 0x1FFC,    -9, 1 }, { 0x2126, 0x2126, -7517, 1 },
+    { 0x212A, 0x212A, -8383, 1 }, { 0x212B, 0x212B, -8262, 1 }, { 0x2132, 0x2132,    28, 1 },
+    { 0x2160, 0x216F,    16, 1 }, { 0x2183, 0x2183,     1, 1 }, { 0x24B6, 0x24CF,    26, 1 },
+    { 0x2C00, 0x2C2F,    48, 1 }, { 0x2C60, 0x2C60,     1, 1 }, { 0x2C62, 0x2C62,-10743, 1 },
+    { 0x2C63, 0x2C63, -3814, 1 }, { 0x2C64, 0x2C64,-10727, 1 }, { 0x2C67, 0x2C6B,     1, 2 },
+    { 0x2C6D, 0x2C6D,-10780, 1 }, { 0x2C6E, 0x2C6E,-10749, 1 }, { 0x2C6F, 0x2C6F,-10783, 1 },
+    { 0x2C70, 0x2C70,-10782, 1 }, { 0x2C72, 0x2C72,     1, 1 }, { 0x2C75, 0x2C75,     1, 1 },
+    { 0x2C7E, 0x2C7F,-10815, 1 }, { 0x2C80, 0x2CE2,     1, 2 }, { 0x2CEB, 0x2CED,     1, 2 },
+    { 0x2CF2, 0x2CF2,     1, 1 }, { 0xA640, 0xA66C,     1, 2 }, { 0xA680, 0xA69A,     1, 2 },
+    { 0xA722, 0xA72E,     1, 2 }, { 0xA732, 0xA76E,     1, 2 }, { 0xA779, 0xA77B,     1, 2 },
+    { 0xA77D, 0xA77D,-35332, 1 }, { 0xA77E, 0xA786,     1, 2 }, { 0xA78B, 0xA78B,     1, 1 },
+    { 0xA78D, 0xA78D,-42280, 1 }, { 0xA790, 0xA792,     1, 2 }, { 0xA796, 0xA7A8,     1, 2 },
+    { 0xA7AA, 0xA7AA,-42308, 1 }, { 0xA7AB, 0xA7AB,-42319, 1 }, { 0xA7AC, 0xA7AC,-42315, 1 },
+    { 0xA7AD, 0xA7AD,-42305, 1 }, { 0xA7AE, 0xA7AE,-42308, 1 }, { 0xA7B0, 0xA7B0,-42258, 1 },
+    { 0xA7B1, 0xA7B1,-42282, 1 }, { 0xA7B2, 0xA7B2,-42261, 1 }, { 0xA7B3, 0xA7B3,   928, 1 },
+    { 0xA7B4, 0xA7C2,     1, 2 }, { 0xA7C4, 0xA7C4,   -48, 1 }, { 0xA7C5, 0xA7C5,-42307, 1 },
+    { 0xA7C6, 0xA7C6,-35384, 1 }, { 0xA7C7, 0xA7C9,     1, 2 }, { 0xA7D0, 0xA7D0,     1, 1 },
+    { 0xA7D6, 0xA7D8,     1, 2 }, { 0xA7F5, 0xA7F5,     1, 1 }, { 0xFF21, 0xFF3A,    32, 1 },
+    { 0x10400, 0x10427,    40, 1 }, { 0x104B0, 0x104D3,    40, 1 }, { 0x10570, 0x1057A,    39, 1 },
+    { 0x1057C, 0x1058A,    39, 1 }, { 0x1058C, 0x10592,    39, 1 }, { 0x10594, 0x10595,    39, 1 },
+    { 0x10C80, 0x10CB2,    64, 1 }, { 0x118A0, 0x118BF,    32, 1 }, { 0x16E40, 0x16E5F,    32, 1 },
+    { 0x1E900, 0x1E921,    34, 1 },
+};
+
+//! Simple upper-case mappings (UnicodeData.txt field 12) outside of ASCII. Must be kept sorted.
+static const struct case_range upper_table[] =
+{
+    { 0x00B5, 0x00B5,   743, 1 }, { 0x00E0, 0x00F6,   -32, 1 }, { 0x00F8, 0x00FE,   -32, 1 },
+    { 0x00FF, 0x00FF,   121, 1 }, { 0x0101, 0x012F,    -1, 2 }, { 0x0131, 0x0131,  -232, 1 },
+    { 0x0133, 0x0137,    -1, 2 }, { 0x013A, 0x0148,    -1, 2 }, { 0x014B, 0x0177,    -1, 2 },
+    { 0x017A, 0x017E,    -1, 2 }, { 0x017F, 0x017F,  -300, 1 }, { 0x0180, 0x0180,   195, 1 },
+    { 0x0183, 0x0185,    -1, 2 }, { 0x0188, 0x0188,    -1, 1 }, { 0x018C, 0x018C,    -1, 1 },
+    { 0x0192, 0x0192,    -1, 1 }, { 0x0195, 0x0195,    97, 1 }, { 0x0199, 0x0199,    -1, 1 },
+    { 0x019A, 0x019A,   163, 1 }, { 0x019E, 0x019E,   130, 1 }, { 0x01A1, 0x01A5,    -1, 2 },
+    { 0x01A8, 0x01A8,    -1, 1 }, { 0x01AD, 0x01AD,    -1, 1 }, { 0x01B0, 0x01B0,    -1, 1 },
+    { 0x01B4, 0x01B6,    -1, 2 }, { 0x01B9, 0x01B9,    -1, 1 }, { 0x01BD, 0x01BD,    -1, 1 },
+    { 0x01BF, 0x01BF,    56, 1 }, { 0x01C5, 0x01C5,    -1, 1 }, { 0x01C6, 0x01C6,    -2, 1 },
+    { 0x01C8, 0x01C8,    -1, 1 }, { 0x01C9, 0x01C9,    -2, 1 }, { 0x01CB, 0x01CB,    -1, 1 },
+    { 0x01CC, 0x01CC,    -2, 1 }, { 0x01CE, 0x01DC,    -1, 2 }, { 0x01DD, 0x01DD,   -79, 1 },
+    { 0x01DF, 0x01EF,    -1, 2 }, { 0x01F2, 0x01F2,    -1, 1 }, { 0x01F3, 0x01F3,    -2, 1 },
+    { 0x01F5, 0x01F5,    -1, 1 }, { 0x01F9, 0x021F,    -1, 2 }, { 0x0223, 0x0233,    -1, 2 },
+    { 0x023C, 0x023C,    -1, 1 }, { 0x023F, 0x0240, 10815, 1 }, { 0x0242, 0x0242,    -1, 1 },
+    { 0x0247, 0x024F,    -1, 2 }, { 0x0250, 0x0250, 10783, 1 }, { 0x0251, 0x0251, 10780, 1 },
+    { 0x0252, 0x0252, 10782, 1 }, { 0x0253, 0x0253,  -210, 1 }, { 0x0254, 0x0254,  -206, 1 },
+    { 0x0256, 0x0257,  -205, 1 }, { 0x0259, 0x0259,  -202, 1 }, { 0x025B, 0x025B,  -203, 1 },
+    { 0x025C, 0x025C, 42319, 1 }, { 0x0260, 0x0260,  -205, 1 }, { 0x0261, 0x0261, 42315, 1 },
+    { 0x0263, 0x0263,  -207, 1 }, { 0x0265, 0x0265, 42280, 1 }, { 0x0266, 0x0266, 42308, 1 },
+    { 0x0268, 0x0268,  -209, 1 }, { 0x0269, 0x0269,  -211, 1 }, { 0x026A, 0x026A, 42308, 1 },
+    { 0x026B, 0x026B, 10743, 1 }, { 0x026C, 0x026C, 42305, 1 }, { 0x026F, 0x026F,  -211, 1 },
+    { 0x0271, 0x0271, 10749, 1 }, { 0x0272, 0x0272,  -213, 1 }, { 0x0275, 0x0275,  -214, 1 },
+    { 0x027D, 0x027D, 10727, 1 }, { 0x0280, 0x0280,  -218, 1 }, { 0x0282, 0x0282, 42307, 1 },
+    { 0x0283, 0x0283,  -218, 1 }, { 0x0287, 0x0287, 42282, 1 }, { 0x0288, 0x0288,  -218, 1 },
+    { 0x0289, 0x0289,   -69, 1 }, { 0x028A, 0x028B,  -217, 1 }, { 0x028C, 0x028C,   -71, 1 },
+    { 0x0292, 0x0292,  -219, 1 }, { 0x029D, 0x029D, 42261, 1 }, { 0x029E, 0x029E, 42258, 1 },
+    { 0x0345, 0x0345,    84, 1 }, { 0x0371, 0x0373,    -1, 2 }, { 0x0377, 0x0377,    -1, 1 },
+    { 0x037B, 0x037D,   130, 1 }, { 0x03AC, 0x03AC,   -38, 1 }, { 0x03AD, 0x03AF,   -37, 1 },
+    { 0x03B1, 0x03C1,   -32, 1 }, { 0x03C2, 0x03C2,   -31, 1 }, { 0x03C3, 0x03CB,   -32, 1 },
+    { 0x03CC, 0x03CC,   -64, 1 }, { 0x03CD, 0x03CE,   -63, 1 }, { 0x03D0, 0x03D0,   -62, 1 },
+    { 0x03D1, 0x03D1,   -57, 1 }, { 0x03D5, 0x03D5,   -47, 1 }, { 0x03D6, 0x03D6,   -54, 1 },
+    { 0x03D7, 0x03D7,    -8, 1 }, { 0x03D9, 0x03EF,    -1, 2 }, { 0x03F0, 0x03F0,   -86, 1 },
+    { 0x03F1, 0x03F1,   -80, 1 }, { 0x03F2, 0x03F2,     7, 1 }, { 0x03F3, 0x03F3,  -116, 1 },
+    { 0x03F5, 0x03F5,   -96, 1 }, { 0x03F8, 0x03F8,    -1, 1 }, { 0x03FB, 0x03FB,    -1, 1 },
+    { 0x0430, 0x044F,   -32, 1 }, { 0x0450, 0x045F,   -80, 1 }, { 0x0461, 0x0481,    -1, 2 },
+    { 0x048B, 0x04BF,    -1, 2 }, { 0x04C2, 0x04CE,    -1, 2 }, { 0x04CF, 0x04CF,   -15, 1 },
+    { 0x04D1, 0x052F,    -1, 2 }, { 0x0561, 0x0586,   -48, 1 }, { 0x10D0, 0x10FA,  3008, 1 },
+    { 0x10FD, 0x10FF,  3008, 1 }, { 0x13F8, 0x13FD,    -8, 1 }, { 0x1C80, 0x1C80, -6254, 1 },
+    { 0x1C81, 0x1C81, -6253, 1 }, { 0x1C82, 0x1C82, -6244, 1 }, { 0x1C83, 0x1C84, -6242, 1 },
+    { 0x1C85, 0x1C85, -6243, 1 }, { 0x1C86, 0x1C86, -6236, 1 }, { 0x1C87, 0x1C87, -6181, 1 },
+    { 0x1C88, 0x1C88, 35266, 1 }, { 0x1D79, 0x1D79, 35332, 1 }, { 0x1D7D, 0x1D7D,  3814, 1 },
+    { 0x1D8E, 0x1D8E, 35384, 1 }, { 0x1E01, 0x1E95,    -1, 2 }, { 0x1E9B, 0x1E9B,   -59, 1 },
+    { 0x1EA1, 0x1EFF,    -1, 2 }, { 0x1F00, 0x1F07,     8, 1 }, { 0x1F10, 0x1F15,     8, 1 },
+    { 0x1F20, 0x1F27,     8, 1 }, { 0x1F30, 0x1F37,     8, 1 }, { 0x1F40, 0x1F45,     8, 1 },
+    { 0x1F51, 0x1F57,     8, 2 }, { 0x1F60, 0x1F67,     8, 1 }, { 0x1F70, 0x1F71,    74, 1 },
+    { 0x1F72, 0x1F75,    86, 1 }, { 0x1F76, 0x1F77,   100, 1 }, { 0x1F78, 0x1F79,   128, 1 },
+    { 0x1F7A, 0x1F7B,   112, 1 }, { 0x1F7C, 0x1F7D,   126, 1 }, { 0x1F80, 0x1F87,     8, 1 },
+    { 0x1F90, 0x1F97,     8, 1 }, { 0x1FA0, 0x1FA7,     8, 1 }, { 0x1FB0, 0x1FB1,     8, 1 },
+    { 0x1FB3, 0x1FB3,     9, 1 }, { 0x1FBE, 0x1FBE, -7205, 1 }, { 0x1FC3, 0x1FC3,     9, 1 },
+    { 0x1FD0, 0x1FD1,     8, 1 }, { 0x1FE0, 0x1FE1,     8, 1 }, { 0x1FE5, 0x1FE5,     7, 1 },
+    { 0x1FF3, 0x1FF3,     9, 1 }, { 0x214E, 0x214E,   -28, 1 }, { 0x2170, 0x217F,   -16, 1 },
+    { 0x2184, 0x2184,    -1, 1 }, { 0x24D0, 0x24E9,   -26, 1 }, { 0x2C30, 0x2C5F,   -48, 1 },
+    { 0x2C61, 0x2C61,    -1, 1 }, { 0x2C65, 0x2C65,-10795, 1 }, { 0x2C66, 0x2C66,-10792, 1 },
+    { 0x2C68, 0x2C6C,    -1, 2 }, { 0x2C73, 0x2C73,    -1, 1 }, { 0x2C76, 0x2C76,    -1, 1 },
+    { 0x2C81, 0x2CE3,    -1, 2 }, { 0x2CEC, 0x2CEE,    -1, 2 }, { 0x2CF3, 0x2CF3,    -1, 1 },
+    { 0x2D00, 0x2D25, -7264, 1 }, { 0x2D27, 0x2D27, -7264, 1 }, { 0x2D2D, 0x2D2D, -7264, 1 },
+    { 0xA641, 0xA66D,    -1, 2 }, { 0xA681, 0xA69B,    -1, 2 }, { 0xA723, 0xA72F,    -1, 2 },
+    { 0xA733, 0xA76F,    -1, 2 }, { 0xA77A, 0xA77C,    -1, 2 }, { 0xA77F, 0xA787,    -1, 2 },
+    { 0xA78C, 0xA78C,    -1, 1 }, { 0xA791, 0xA793,    -1, 2 }, { 0xA794, 0xA794,    48, 1 },
+    { 0xA797, 0xA7A9,    -1, 2 }, { 0xA7B5, 0xA7C3,    -1, 2 }, { 0xA7C8, 0xA7CA,    -1, 2 },
+    { 0xA7D1, 0xA7D1,    -1, 1 }, { 0xA7D7, 0xA7D9,    -1, 2 }, { 0xA7F6, 0xA7F6,    -1, 1 },
+    { 0xAB53, 0xAB53,  -928, 1 }, { 0xAB70, 0xABBF,-38864, 1 }, { 0xFF41, 0xFF5A,   -32, 1 },
+    { 0x10428, 0x1044F,   -40, 1 }, { 0x104D8, 0x104FB,   -40, 1 }, { 0x10597, 0x105A1,   -39, 1 },
+    { 0x105A3, 0x105B1,   -39, 1 }, { 0x105B3, 0x105B9,   -39, 1 }, { 0x105BB, 0x105BC,   -39, 1 },
+    { 0x10CC0, 0x10CF2,   -64, 1 }, { 0x118C0, 0x118DF,   -32, 1 }, { 0x16E60, 0x16E7F,   -32, 1 },
+    { 0x1E922, 0x1E943,   -34, 1 },
+};
+
+//! Simple case foldings (CaseFolding.txt, status C and S) that differ from the lower-case mapping.
+//! A delta of 0 marks code points that lower-case but don't fold, such as U+0130 (it has no simple
+//! folding) or Cherokee, which folds to upper case.
+static const struct case_range fold_table[] =
+{
+    { 0x00B5, 0x00B5,   775, 1 }, { 0x0130, 0x0130,     0, 1 }, { 0x017F, 0x017F,  -268, 1 },
+    { 0x0345, 0x0345,   116, 1 }, { 0x03C2, 0x03C2,     1, 1 }, { 0x03D0, 0x03D0,   -30, 1 },
+    { 0x03D1, 0x03D1,   -25, 1 }, { 0x03D5, 0x03D5,   -15, 1 }, { 0x03D6, 0x03D6,   -22, 1 },
+    { 0x03F0, 0x03F0,   -54, 1 }, { 0x03F1, 0x03F1,   -48, 1 }, { 0x03F5, 0x03F5,   -64, 1 },
+    { 0x13A0, 0x13F5,     0, 1 }, { 0x13F8, 0x13FD,    -8, 1 }, { 0x1C80, 0x1C80, -6222, 1 },
+    { 0x1C81, 0x1C81, -6221, 1 }, { 0x1C82, 0x1C82, -6212, 1 }, { 0x1C83, 0x1C84, -6210, 1 },
+    { 0x1C85, 0x1C85, -6211, 1 }, { 0x1C86, 0x1C86, -6204, 1 }, { 0x1C87, 0x1C87, -6180, 1 },
+    { 0x1C88, 0x1C88, 35267, 1 }, { 0x1E9B, 0x1E9B,   -58, 1 }, { 0x1FBE, 0x1FBE, -7173, 1 },
+    { 0xAB70, 0xABBF,-38864, 1 },
+};
+
+//!
+//! \brief __case_lookup Binary searches a case table for a code point.
+//! \param table         One of the sorted case tables.
+//! \param len           Number of entries in `table`.
+//! \param cp            The code point to be looked up.
+//! \return              The matching run, or NULL if `cp` is not mapped by `table`.
+//!
+static const struct case_range * __case_lookup(const struct case_range * table, size_t len, unsigned long cp)
+{
+    size_t lo = 0, hi = len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cp < table[mid].lo)
+        {
+            hi = mid;
+        } else if (cp > table[mid].hi)
+        {
+            lo = mid + 1;
+        } else
+        {
+            if ((cp - table[mid].lo) % table[mid].stride)
+            {
+                return NULL;
+            }
+            return &table[mid];
+        }
+    }
+    return NULL;
+}
+
+enum case_mode { CASE_LOWER, CASE_UPPER, CASE_FOLD };
+
+//!
+//! \brief __case_map_code_point Applies a simple case mapping to a single code point.
+//! \param cp                    The code point to be mapped.
+//! \param mode                  Which mapping to apply.
+//! \return                      The mapped code point (`cp` itself if it has no mapping).
+//!
+static unsigned long __case_map_code_point(unsigned long cp, enum case_mode mode)
+{
+    const struct case_range * range;
+
+    if (cp < 0x80)
+    {
+        if (mode == CASE_UPPER)
+        {
+            return (cp >= 'a' && cp <= 'z') ? cp ^ 0x20 : cp;
+        }
+        return (cp >= 'A' && cp <= 'Z') ? cp ^ 0x20 : cp;
+    }
+
+    if (mode == CASE_FOLD && (range = __case_lookup(fold_table, LIBSTRING_TABLE_LEN(fold_table), cp)))
+    {
+        return (unsigned long) ((long) cp + range->delta);
+    }
+
+    if (mode == CASE_UPPER)
+    {
+        range = __case_lookup(upper_table, LIBSTRING_TABLE_LEN(upper_table), cp);
+    } else
+    {
+        range = __case_lookup(lower_table, LIBSTRING_TABLE_LEN(lower_table), cp);
+    }
+    return range ? (unsigned long) ((long) cp + range->delta) : cp;
+}
+
+//!
+//! \brief __utf8_decode Decodes a single UTF-8 sequence.
+//! \param src           The bytes to decode.
+//! \param len           How many bytes of `src` may be read.
+//! \param cp            Where the decoded code point is written to.
+//! \return              The length of the sequence, or 0 if it is malformed, overlong, truncated or a surrogate.
+//!
+static size_t __utf8_decode(const char * src, size_t len, unsigned long * cp)
+{
+    const unsigned char * s = (const unsigned char *) src;
+    unsigned long min;
+    size_t seq_len, i;
+
+    if (s[0] < 0x80)
+    {
+        *cp = s[0];
+        return 1;
+    } else if ((s[0] & 0xE0) == 0xC0)
+    {
+        seq_len = 2; min = 0x80;    *cp = s[0] & 0x1F;
+    } else if ((s[0] & 0xF0) == 0xE0)
+    {
+        seq_len = 3; min = 0x800;   *cp = s[0] & 0x0F;
+    } else if ((s[0] & 0xF8) == 0xF0)
+    {
+        seq_len = 4; min = 0x10000; *cp = s[0] & 0x07;
+    } else
+    {
+        return 0;
+    }
+
+    if (seq_len > len)
+    {
+        return 0;
+    }
+
+    for (i = 1; i < seq_len; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        *cp = (*cp << 6) | (s[i] & 0x3F);
+    }
+
+    if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF))
+    {
+        return 0;
+    }
+    return seq_len;
+}
+
+//!
+//! \brief __utf8_encode Encodes a code point as UTF-8.
+//! \param cp            A valid code point.
+//! \param dest          Where to write the sequence to. Must have room for 4 bytes.
+//! \return              The number of bytes written.
+//!
+static size_t __utf8_encode(unsigned long cp, char * dest)
+{
+    if (cp < 0x80)
+    {
+        dest[0] = (char) cp;
+        return 1;
+    } else if (cp < 0x800)
+    {
+        dest[0] = (char) (0xC0 | (cp >> 6));
+        dest[1] = (char) (0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000)
+    {
+        dest[0] = (char) (0xE0 | (cp >> 12));
+        dest[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        dest[2] = (char) (0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dest[0] = (char) (0xF0 | (cp >> 18));
+    dest[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+    dest[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+    dest[3] = (char) (0x80 | (cp & 0x3F));
+    return 4;
+}
+
+//!
+//! \brief __case_first_change Finds where a case mapping would start changing a string.
+//! \param origin              The string to be mapped.
+//! \param mode                Which mapping would be applied.
+//! \return                    A position at or before the first character the mapping changes, or origin->size
+//!                            if it changes none.
+//!
+static size_t __case_first_change(cstr_t * origin, enum case_mode mode)
+{
+    size_t n = origin->size, i = 0;
+    const char * src = origin->value;
+    unsigned char lo = mode == CASE_UPPER ? 'a' : 'A';
+    unsigned char hi = mode == CASE_UPPER ? 'z' : 'Z';
+
+    while (i < n)
+    {
+        unsigned long cp;
+        size_t seq_len;
+
+        while (i + LIBSTRING_WORD_SIZE <= n)
+        {
+            size_t word = __load_word(src + i);
+            if (word & LIBSTRING_HIGHS)
+            {
+                break;
+            }
+            if (__swar_ascii_range(word, lo, hi))
+            {
+                return i;
+            }
+            i += LIBSTRING_WORD_SIZE;
+        }
+
+        if (i >= n)
+        {
+            break;
+        }
+
+        seq_len = __utf8_decode(src + i, n - i, &cp);
+        if (!seq_len)
+        {
+            i++;
+        } else if (__case_map_code_point(cp, mode) != cp)
+        {
+            return i;
+        } else
+        {
+            i += seq_len;
+        }
+    }
+    return n;
+}
+
+//!
+//! \brief __string_case_map Builds a case-mapped copy of a UTF-8 string.
+//! \param origin            The string to be mapped. It does not get modified.
+//! \param mode              Which mapping to apply.
+//! \return                  A brand new cstr_t * with the mapped value.
+//! Runs of pure ASCII are translated a word at a time; multibyte sequences go through the case tables.
+//! A mapping may change the length of a sequence (e.g. U+023A is 2 bytes long, its lower-case form
+//! U+2C65 is 3 bytes long), so up to 1.5 times the original size is reserved. Malformed sequences are
+//! copied through unchanged. If the mapping changes nothing, the result shares `origin`'s buffer.
+//!
+static cstr_t * __string_case_map(cstr_t * origin, enum case_mode mode)
+{
+    size_t n = origin->size;
+    size_t i = __case_first_change(origin, mode);
+    unsigned char lo = mode == CASE_UPPER ? 'a' : 'A';
+    unsigned char hi = mode == CASE_UPPER ? 'z' : 'Z';
+    const char * src = origin->value;
+    cstr_t * result;
+    char * dest;
+
+    if (i == n)
+    {
+        return string_dup(origin);
+    }
+
+    result = string_alloc(n + n / 2 + 1);
+    if (!result)
+    {
+        return NULL;
+    }
+    dest = __memcpy(result->value, src, i);
+
+    while (i < n)
+    {
+        unsigned long cp;
+        size_t seq_len;
+
+        while (i + LIBSTRING_WORD_SIZE <= n)
+        {
+            size_t word = __load_word(src + i);
+            if (word & LIBSTRING_HIGHS)
+            {
+                break;      //! There's a multibyte sequence somewhere in this word
+            }
+            __store_word(dest, word ^ __swar_ascii_range(word, lo, hi));
+            dest += LIBSTRING_WORD_SIZE;
+            i    += LIBSTRING_WORD_SIZE;
+        }
+
+        if (i >= n)
+        {
+            break;
+        }
+
+        seq_len = __utf8_decode(src + i, n - i, &cp);
+        if (!seq_len)
+        {
+            *dest++ = src[i++];
+            continue;
+        }
+        dest += __utf8_encode(__case_map_code_point(cp, mode), dest);
+        i    += seq_len;
+    }
+
+    *dest = '\0';
+    result->size = (size_t) (dest - result->value);
+    return result;
+}
+
+//!
+//! \brief string_to_lower_case Alters a string to contain only lower-case characters.
+//! \param origin               The string whose value will be converted to lower-case characters. This parameters does not get modified.
+//! \return                     A brand new cstr_t * that contains the altered value.
+//! `origin` is treated as UTF-8 and mapped with the Unicode simple lower-case mappings.
+//!
+cstr_t * string_to_lower_case(cstr_t * origin)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_TO_LOWER_CASE)
+    if (!LIBSTRING_SANITY_CHECK(origin, "In string_to_lower_case: sanity check on `origin` failed."))
+    {
+        return string_init("");
+    }
+
+    return __string_case_map(origin, CASE_LOWER);
+}
+
+//!
+//! \brief string_to_upper_case Alters a string to contain only upper-case characters.
+//! \param origin               The string whose value will be converted to upper-case characters. This parameters does not get modified.
+//! \return                     A brand new cstr_t * that contains the altered value.
+//! `origin` is treated as UTF-8 and mapped with the Unicode simple upper-case mappings.
+//!
+cstr_t * string_to_upper_case(cstr_t * origin)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_TO_UPPER_CASE)
+    if (!LIBSTRING_SANITY_CHECK(origin, "In string_to_upper_case: sanity check on `origin` failed."))
+    {
+        return string_init("");
+    }
+
+    return __string_case_map(origin, CASE_UPPER);
+}
+
+//!
+//! \brief string_fold_case Case-folds a string, for use in case-insensitive comparisons.
+//! \param origin           The string to be folded. This parameter does not get modified.
+//! \return                 A brand new cstr_t * that contains the folded value.
+//! Uses the Unicode simple case foldings, so e.g. "ΣΑΣ", "σας" and "ΣΑς" all fold to "σασ".
+//!
+cstr_t * string_fold_case(cstr_t * origin)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_FOLD_CASE)
+    if (!LIBSTRING_SANITY_CHECK(origin, "In string_fold_case: sanity check on `origin` failed."))
+    {
+        return string_init("");
+    }
+
+    return __string_case_map(origin, CASE_FOLD);
+}
+
+
+//!
+//! \brief string_replace_n Replaces all instances of `old_val` in `str` with `new_val`.
+//! \param str              The cstr_t * to be altered.
+//! \param old_val          The characters to be replaced. They may contain NULs.
+//! \param old_len          The length of `old_val`. Must not be 0.
+//! \param new_val          The characters to replace `old_val` with. They may contain NULs.
+//! \param new_len          The length of `new_val`.
+//! \return                 How many replacements were made.
+//! Occurrences are found left to right and don't overlap. `old_val` and `new_val` may point into `str`.
+//! When the value doesn't grow, replacing happens in place; otherwise (or when `old_val` or `new_val` live in
+//! `str`'s buffer, which replacing in place would overwrite while they are still needed) the result is written
+//! to a new buffer of the exact size in a single pass.
+//!
+size_t string_replace_n(cstr_t * str, const char * old_val, size_t old_len, const char * new_val, size_t new_len)
+{
+    size_t count = 0, new_size;
+    const char * src, * end, * hit;
+    char * dest;
+    bool aliased;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_REPLACE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_replace_n: sanity check on `str` failed."))
+    {
+        return 0;
+    }
+
+    if (!old_len)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_replace_n: `old_val` must not be empty.");
+        return 0;
+    }
+
+    end = str->value + str->size;
+    for (src = str->value; (hit = __memmem(src, (size_t) (end - src), old_val, old_len)); src = hit + old_len)
+    {
+        count++;
+    }
+    if (!count)
+    {
+        return 0;
+    }
+
+    if (new_len > old_len && count > ((size_t) -1 - str->size) / (new_len - old_len))
+    {
+        __string_error(STRING_ERR_RANGE, "In string_replace_n: the result would be too long.");
+        return 0;
+    }
+    new_size = str->size - count * old_len + count * new_len;
+
+    //! As in string_concat_to_n, the pointers are compared as integers since they may well point elsewhere
+    aliased = (size_t) ((cstr_uintptr_t) old_val - (cstr_uintptr_t) str->value) < str->size ||
+              (size_t) ((cstr_uintptr_t) new_val - (cstr_uintptr_t) str->value) < str->size;
+
+    if (new_len <= old_len && !aliased)
+    {
+        if (!__string_make_writable(str, str->size, true, "In string_replace_n: `str` could not be written to."))
+        {
+            return 0;
+        }
+        dest = str->value;      //! Never gets ahead of `src`, so this can be done in place
+    } else
+    {
+        if (!(str->flags & STRING_OWNED))
+        {
+            __string_error(STRING_ERR_READONLY, "In string_replace_n: `str` does not own its buffer.");
+            return 0;
+        }
+        dest = __buf_alloc(new_size);
+        if (!dest)
+        {
+            __string_error(STRING_ERR_ALLOC, "In string_replace_n: allocation failed.");
+            return 0;
+        }
+    }
+
+    {
+        char * start = dest;
+        end = str->value + str->size;
+        for (src = str->value; (hit = __memmem(src, (size_t) (end - src), old_val, old_len)); src = hit + old_len)
+        {
+            dest = __memcpy(dest, src, (size_t) (hit - src));
+            dest = __memcpy(dest, new_val, new_len);
+        }
+        dest = __memcpy(dest, src, (size_t) (end - src));
+        *dest = '\0';
+
+        if (start != str->value)
+        {
+            LIBSTRING_STATS_RESERVED(str->reserved, new_size);
+            __buf_release(str->value, str->reserved);
+            str->value    = start;
+            str->reserved = new_size;
+        }
+    }
+    str->size = new_size;
+    return count;
+}
+
+//!
+//! \brief string_replace Replaces all instances of `old_val` in `str` with `new_val`.
+//! \param str            The cstr_t * to be altered.
+//! \param old_val        The NUL-terminated string to be replaced.
+//! \param new_val        The NUL-terminated string to replace `old_val` with.
+//!
+void string_replace(cstr_t * str, char * old_val, const char * new_val)
+{
+    string_replace_n(str, old_val, __strlen(old_val), new_val, __strlen(new_val));
+}
+
+//!
+//! \brief string_replace_view Replaces all instances of `old_val` in `str` with `new_val`.
+//! \return                   How many replacements were made.
+//!
+size_t string_replace_view(cstr_t * str, cstr_view_t old_val, cstr_view_t new_val)
+{
+    return string_replace_n(str, old_val.value, old_val.size, new_val.value, new_val.size);
+}
+
+//!
+//! \brief string_view Returns a view of the current value of a string.
+//! The view is invalidated when `str` gets modified or freed.
+//!
+cstr_view_t string_view(const cstr_t * str)
+{
+    cstr_view_t view;
+    view.value = str->value;
+    view.size  = str->size;
+    return view;
+}
+
+//!
+//! \brief __string_from Creates a new string holding a copy of the first `len` characters of `value`.
+//!
+static cstr_t * __string_from(const char * value, size_t len)
+{
+    cstr_t * new = string_alloc(len + 1);
+    if (new)
+    {
+        __memcpy(new->value, value, len);
+        new->value[len] = '\0';
+        new->size = len;
+    }
+    return new;
+}
+
+//!
+//! \brief string_init Initializes a new cstr_t *.
+//! \param origin      The char array to be the value of the new string.
+//! \return            A brand new cstr_t *.
+//!
+cstr_t * string_init(const char * origin)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INIT)
+    return __string_from(origin, origin ? __strlen(origin) : 0);
+}
+
+//!
+//! \brief string_init_n Initializes a new cstr_t * from the first `len` characters of `origin`.
+//! \param origin        The characters to be the value of the new string. They may contain NULs.
+//! \param len           How many characters to take from `origin`.
+//! \return              A brand new cstr_t *.
+//!
+cstr_t * string_init_n(const char * origin, size_t len)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INIT)
+    return __string_from(origin, len);
+}
+
+//!
+//! \brief string_dup Returns a copy of a string in constant time.
+//! \param str        The string to be copied.
+//! \return           A brand new cstr_t * that shares its buffer with `str` until either of them gets modified.
+//! Strings that don't own their buffer (see STRING_OWNED) get deep-copied instead.
+//!
+cstr_t * string_dup(cstr_t * str)
+{
+    cstr_t * copy;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_DUP)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_dup: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
+
+    if (!(str->flags & STRING_OWNED))
+    {
+        return __string_from(str->value, str->size);
+    }
+
+    ++*__buf_refs(str->value);
+    copy = __string_register(str->value, str->size, str->reserved);
+    if (!copy)
+    {
+        --*__buf_refs(str->value);
+    }
+    return copy;
+}
+//!
+//! \brief string_update  Updates the value of an cstr_t *. Increases its memory reservation if needed.
+//! \param str            The cstr_t * to be modified.
+//! \param new_val        The new char array value.
+//! \return               The new string's size.
+//!
+size_t string_update(cstr_t * str, const char * new_val)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_UPDATE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_update: sanity check on `str` failed."))
+    {
+        return 0;
+    }
+
+    if (!new_val)
+    {
+        return 0;
+    }
+
+    size_t new_string_len = __strlen(new_val);
+    //! The old value gets overwritten, so a shared buffer doesn't need to be copied
+    if (!__string_make_writable(str, new_string_len, false, "In string_update: `str` could not be written to."))
+    {
+        return 0;
+    }
+
+    __memcpy(str->value, new_val, new_string_len);
+    str->value[new_string_len] = '\0';
+    str->size = new_string_len;
+    return new_string_len;
+}
+
+//!
+//! \brief string_contains_n Verifies if the first `len` characters of `str2` are a substring of `str1`.
+//! \param str1              The string to be searched.
+//! \param str2              The characters to search for. They may contain NULs.
+//! \param len               The length of `str2`.
+//! \return                  True if `str2` occurs in `str1`.
+//!
+bool string_contains_n(cstr_t * str1, const char * str2, size_t len)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_CONTAINS)
+    if (!LIBSTRING_SANITY_CHECK(str1, "In string_contains_n: sanity check on `str1` failed."))
+    {
+        return false;
+    }
+
+    if (str1->size < len)
+    {
+        //! str2 is bigger than str1, so it can't be a substring.
+        return false;
+    }
+
+    return __memmem(str1->value, str1->size, str2, len) != NULL;
+}
+
+//!
+//! \brief string_contains Verifies if `str2` is a substring of `str1`.
+//! \param str1            The string to be searched.
+//! \param str2            The NUL-terminated string to search for.
+//! \return                True if `str2` occurs in `str1`.
+//!
+bool string_contains(cstr_t * str1, const char * str2)
+{
+    return string_contains_n(str1, str2, __strlen(str2));
+}
+
+//!
+//! \brief string_contains_view Verifies if `str2` is a substring of `str1`.
+//!
+bool string_contains_view(cstr_t * str1, cstr_view_t str2)
+{
+    return string_contains_n(str1, str2.value, str2.size);
+}
+
+//!
+//! \brief string_index_of Finds the first occurrence of `c` in `str`.
+//! \param str            The string to be searched.
+//! \param c              The char to search for.
+//! \return               Its position, or STRING_NPOS if `c` isn't in `str`.
+//!
+size_t string_index_of(cstr_t * str, char c)
+{
+    const char * found;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_OF)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_index_of: sanity check on `str` failed."))
+    {
+        return STRING_NPOS;
+    }
+
+    found = __memchr(str->value, c, str->size);
+    return found ? (size_t) (found - str->value) : STRING_NPOS;
+}
+
+//!
+//! \brief string_last_index_of Finds the last occurrence of `c` in `str`.
+//! \return                    Its position, or STRING_NPOS if `c` isn't in `str`.
+//!
+size_t string_last_index_of(cstr_t * str, char c)
+{
+    const char * found;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_OF)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_last_index_of: sanity check on `str` failed."))
+    {
+        return STRING_NPOS;
+    }
+
+    found = __memrchr(str->value, c, str->size);
+    return found ? (size_t) (found - str->value) : STRING_NPOS;
+}
+
+//!
+//! \brief string_count_char Counts the occurrences of `c` in `str`.
+//! \return                 How many there are.
+//!
+size_t string_count_char(cstr_t * str, char c)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_OF)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_count_char: sanity check on `str` failed."))
+    {
+        return 0;
+    }
+    return __count_char(str->value, c, str->size);
+}
+
+//!
+//! \brief string_starts_with_x Verifies if `str` begins with `x`.
+//! \param str                 The string to be checked.
+//! \param x                   The prefix to look for.
+//! \return                    True if the first x->size chars of `str` are those of `x`.
+//!
+bool string_starts_with_x(cstr_t * str, cstr_t * x)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_OF)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_starts_with_x: sanity check on `str` failed."))
+    {
+        return false;
+    }
+    if (!LIBSTRING_SANITY_CHECK(x, "In string_starts_with_x: sanity check on `x` failed."))
+    {
+        return false;
+    }
+    return x->size <= str->size && __memeq_words(str->value, x->value, x->size);
+}
+
+//!
+//! \brief string_ends_with_x Verifies if `str` ends with `x`.
+//! \return                  True if the last x->size chars of `str` are those of `x`.
+//!
+bool string_ends_with_x(cstr_t * str, cstr_t * x)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_OF)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_ends_with_x: sanity check on `str` failed."))
+    {
+        return false;
+    }
+    if (!LIBSTRING_SANITY_CHECK(x, "In string_ends_with_x: sanity check on `x` failed."))
+    {
+        return false;
+    }
+    return x->size <= str->size && __memeq_words(str->value + str->size - x->size, x->value, x->size);
+}
+
+//!
+//! \brief __fold_next Reads and case-folds a single character.
+//! \param src         The characters to read from.
+//! \param len         How many of them may be read.
+//! \param folded      Where the folded code point is written to. Malformed bytes give values above any code point.
+//! \return            How many bytes were read.
+//!
+static LIBSTRING_INLINE size_t __fold_next(const char * src, size_t len, unsigned long * folded)
+{
+    unsigned char c = (unsigned char) src[0];
+    size_t seq_len;
+
+    if (c < 0x80)
+    {
+        *folded = (c >= 'A' && c <= 'Z') ? (unsigned long) (c ^ 0x20) : c;
+        return 1;
+    }
+    seq_len = __utf8_decode(src, len, folded);
+    if (!seq_len)
+    {
+        *folded = 0x110000ul + c;
+        return 1;
+    }
+    *folded = __case_map_code_point(*folded, CASE_FOLD);
+    return seq_len;
+}
+
+//!
+//! \brief __nocase_match_at Verifies if `needle` matches the start of `hay` when both are case-folded.
+//! Runs of ASCII on both sides are folded and compared a word at a time.
+//!
+static bool __nocase_match_at(const char * hay, size_t hay_len, const char * needle, size_t len)
+{
+    size_t i = 0, j = 0;
+
+    while (j < len)
+    {
+        unsigned long a, b;
+
+        while (i + LIBSTRING_WORD_SIZE <= hay_len && j + LIBSTRING_WORD_SIZE <= len)
+        {
+            size_t x = __load_word(hay + i), y = __load_word(needle + j);
+            if ((x | y) & LIBSTRING_HIGHS)
+            {
+                break;
+            }
+            if ((x | __swar_ascii_range(x, 'A', 'Z')) != (y | __swar_ascii_range(y, 'A', 'Z')))
+            {
+                return false;
+            }
+            i += LIBSTRING_WORD_SIZE;
+            j += LIBSTRING_WORD_SIZE;
+        }
+
+        if (j == len)
+        {
+            break;
+        }
+        if (i == hay_len)
+        {
+            return false;
+        }
+        i += __fold_next(hay + i, hay_len - i, &a);
+        j += __fold_next(needle + j, len - j, &b);
+        if (a != b)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//!
+//! \brief __find_nocase Finds the first case-insensitive occurrence of `needle` in `hay`.
+//! \return              Its position, or STRING_NPOS if there is none.
+//! Candidates are found a word at a time: bytes that fold to the first folded character of the needle, and every
+//! non-ASCII byte, since some non-ASCII characters fold to ASCII ones (e.g. U+212A KELVIN SIGN to 'k').
+//!
+static size_t __find_nocase(const char * hay, size_t n, const char * needle, size_t len)
+{
+    unsigned long first;
+    size_t i = 0, target = 0, case_bits = 0;
+
+    if (!len)
+    {
+        return 0;
+    }
+
+    __fold_next(needle, len, &first);
+    if (first < 0x80)
+    {
+        target = LIBSTRING_ONES * first;
+        if (first >= 'a' && first <= 'z')
+        {
+            case_bits = LIBSTRING_ONES * 0x20;  //! Only 'A' and 'a' give 'a' once OR-ed with 0x20
+        }
+    }
+
+    while (i < n)
+    {
+        unsigned char c;
+
+        while (i + LIBSTRING_WORD_SIZE <= n)
+        {
+            size_t word  = __load_word(hay + i);
+            size_t marks = word & LIBSTRING_HIGHS;
+            if (first < 0x80)
+            {
+                marks |= __swar_zero_bytes((word | case_bits) ^ target);
+            }
+            if (marks)
+            {
+                i += __swar_first_marked(marks);
+                break;
+            }
+            i += LIBSTRING_WORD_SIZE;
+        }
+
+        if (i >= n)
+        {
+            break;
+        }
+        c = (unsigned char) hay[i];
+        if (c >= 0x80 || (unsigned long) ((c >= 'A' && c <= 'Z') ? c ^ 0x20 : c) == first)
+        {
+            if (__nocase_match_at(hay + i, n - i, needle, len))
+            {
+                return i;
+            }
+        }
+        i++;
+    }
+    return STRING_NPOS;
+}
+
+//!
+//! \brief string_find_nocase_n Finds the first occurrence of the first `len` characters of `needle` in `str`,
+//!                             ignoring case.
+//! \param str                  The string to be searched.
+//! \param needle               The characters to search for. They may contain NULs.
+//! \param len                  The length of `needle`.
+//! \return                     The position of the occurrence, or STRING_NPOS if there is none.
+//! Both sides are treated as UTF-8 and compared with the Unicode simple case foldings (see string_fold_case),
+//! folding them on the fly, so nothing gets allocated.
+//!
+size_t string_find_nocase_n(cstr_t * str, const char * needle, size_t len)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_FIND_NOCASE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_find_nocase_n: sanity check on `str` failed."))
+    {
+        return STRING_NPOS;
+    }
+    return __find_nocase(str->value, str->size, needle, len);
+}
+
+//!
+//! \brief string_find_nocase Finds the first occurrence of `needle` in `str`, ignoring case.
+//! \param str                The string to be searched.
+//! \param needle             The NUL-terminated string to search for.
+//! \return                   The position of the occurrence, or STRING_NPOS if there is none.
+//!
+size_t string_find_nocase(cstr_t * str, const char * needle)
+{
+    return string_find_nocase_n(str, needle, __strlen(needle));
+}
+
+//!
+//! \brief string_contains_nocase_n Verifies if the first `len` characters of `str2` are a substring of `str1`,
+//!                                 ignoring case.
+//! \return                         True if `str2` occurs in `str1`.
+//!
+bool string_contains_nocase_n(cstr_t * str1, const char * str2, size_t len)
+{
+    return string_find_nocase_n(str1, str2, len) != STRING_NPOS;
+}
+
+//!
+//! \brief string_contains_nocase Verifies if `str2` is a substring of `str1`, ignoring case.
+//! \return                       True if `str2` occurs in `str1`.
+//!
+bool string_contains_nocase(cstr_t * str1, const char * str2)
+{
+    return string_contains_nocase_n(str1, str2, __strlen(str2));
+}
+
+/*!
+ * \brief  Initializes a new string, a pointer to cstr_t
+ * \param  str       The cstr_t * whose capacity will be altered.
+ * \param  capacity  The new memory reserve of the cstr_t *.
+ * \retval bool    Returns true if the operation was succesful, false otherwise.
+ */
+bool string_reserve(cstr_t *str, size_t capacity)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_RESERVE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_reserve: sanity check on `str` failed."))
+    {
+        return false;
+    }
+
+    if (capacity < str->size)
+    {
+        //! TODO: Implement truncation?
+        __string_error(STRING_ERR_RANGE, "In string_reserve: new capacity supplied is smaller than the string's current size.");
+        return false;
+    }
+
+    if (!(str->flags & STRING_OWNED))
+    {
+        __string_error(STRING_ERR_READONLY, "In string_reserve: `str` does not own its buffer.");
+        return false;
+    }
+
+    if(!__string_resize_buffer(str, capacity, true))
+    {
+        //! The original buffer is still valid when reallocation fails
+        __string_error(STRING_ERR_ALLOC, "In string_reserve: reallocation failed.");
+        return false;
+    }
+    return true;
+}
+
+//!
+//! \brief string_concat_to_n Concatenates the first `len` characters of `str2` to str1.
+//! \param str1 The cstr_t * to where str2 will be concatenated to.
+//! \param str2 The characters that will be concatenated to str1. They may contain NULs, and may point into str1.
+//! \param len  The length of `str2`.
+//! \return The number of characters appended.
+//!
+size_t string_concat_to_n(cstr_t * str1, const char * str2, size_t len)
+{
+    size_t offset;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_CONCAT_TO)
+    if (!LIBSTRING_SANITY_CHECK(str1, "In string_concat_to_n: sanity check on `str1` failed."))
+    {
+        return 0;
+    }
+
+    if(!len) {
+        return 0;
+    }
+
+    //! str2 has to be found again if it lives in str1's buffer and that buffer moves.
+    //! It may well point elsewhere, so the pointers are compared as integers rather than subtracted.
+    offset = (size_t) ((cstr_uintptr_t) str2 - (cstr_uintptr_t) str1->value);
+    if(!__string_make_writable(str1, str1->size + len, true, "In string_concat_to_n: `str1` could not be written to."))
+    {
+        return 0;
+    }
+    if (offset < str1->size)
+    {
+        str2 = str1->value + offset;
+    }
+
+    __memcpy(str1->value + str1->size, str2, len);
+    str1->size += len;
+    str1->value[str1->size] = '\0';
+    return len;
+}
+
+//!
+//! \brief string_concat_to Concatenates a string str2 to str1.
+//! \param str1 The cstr_t * to where str2 will be concatenated to.
+//! \param str2 The string that will be concatenated to str1.
+//! \return The number of characters appended.
+//!
+size_t string_concat_to(cstr_t * str1, const char * str2)
+{
+    return string_concat_to_n(str1, str2, __strlen(str2));
+}
+
+//!
+//! \brief string_concat_to_view Concatenates a view to str1.
+//! \return The number of characters appended.
+//!
+size_t string_concat_to_view(cstr_t * str1, cstr_view_t str2)
+{
+    return string_concat_to_n(str1, str2.value, str2.size);
+}
+
+//!
+//! \brief string_concat Concatenates str2 to str1 and returns that value into a new cstr_t *.
+//! \param str1          The value to where str2 will be concatenated to. The function does not alter str1.
+//! \param str2          The string that will be concatenated to str1.
+//! \return              A new value containing str1 + str2
+//!
+cstr_t * string_concat(cstr_t * str1, const char * str2)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_CONCAT)
+    if (!LIBSTRING_SANITY_CHECK(str1, "In string_concat: sanity check on `str1` failed."))
+    {
+        return 0;
+    }
+
+    size_t str2len = __strlen(str2);
+    if (!str2len)
+    {
+        return string_dup(str1);    //! Same value, so no need for a copy
+    }
+
+    cstr_t * new = string_alloc(str1->size + str2len + 1);
+    if (!new)
+    {
+        return NULL;
+    }
+    __memcpy(new->value, str1->value, str1->size);
+    __memcpy(new->value + str1->size, str2, str2len + 1);
+    return new;
+}
+
+//!
+//! \brief string_replace_char Replaces all instances of `before` in str to `after`.
+//! \param str                 The cstr_t * to be altered.
+//! \param before              The char to be replaced by `after`.
+//! \param after               The char to replace `before`.
+//! \return                    The quantity of changed characters.
+//!
+//! TODO: make string_replace_char_to
+//!
+size_t string_replace_char(cstr_t *str, char before, char after)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_REPLACE_CHAR)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_replace_char: sanity check on `str` failed."))
+    {
+        return 0;
+    }
+
+    const char * first;
+    char * p;
+    size_t i, n, marks, pattern, flip, modified = 0;
+
+    //! Nothing gets written (so a shared buffer isn't copied) until there's something to replace
+    first = __memchr(str->value, before, str->size);
+    if (!first)
+    {
+        return 0;
+    }
+    i = (size_t) (first - str->value);
+
+    if (before == after)
+    {
+        return __count_char(first, before, str->size - i);
+    }
+
+    if (!__string_make_writable(str, str->size, true, "In string_replace_char: `str` could not be written to."))
+    {
+        return 0;
+    }
+
+    //! Every byte equal to `before` gets XOR-ed with (before ^ after), which turns it into `after`
+    pattern = LIBSTRING_ONES * (unsigned char) before;
+    flip = LIBSTRING_ONES * (unsigned char) (before ^ after);
+    for (p = str->value + i, n = str->size - i; n >= LIBSTRING_WORD_SIZE; n -= LIBSTRING_WORD_SIZE, p += LIBSTRING_WORD_SIZE)
+    {
+        size_t word = __load_word(p);
+        marks = __swar_zero_bytes(word ^ pattern);
+        if (marks)
+        {
+            __store_word(p, word ^ (flip & ((marks >> 7) * 0xFF)));
+            modified += __swar_count_marked(marks);
+        }
+    }
+    for (; n; n--, p++)
+    {
+        if (*p == before)
+        {
+            *p = after;
+            modified++;
+        }
+    }
+    return modified;
+}
+
+//!
+//! \brief string_swap Swaps the content of str1 with str2.
+//! \param str1        An initialized cstr_t *.
+//! \param str2        An initialized cstr_t *.
+//! \return A success-run boolean.
+//! Fails if only one of them owns its buffer (see STRING_OWNED): a literal or a string put together by hand
+//! would otherwise end up holding a buffer libstring has to free, and a registered string one it can't write to.
+//!
+bool string_swap(cstr_t * str1, cstr_t * str2)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_SWAP)
+    if (!LIBSTRING_SANITY_CHECK(str1, "In string_swap: sanity check on `str1` failed."))
+    {
+        return false;
+    }
+    if (!LIBSTRING_SANITY_CHECK(str2, "In string_swap: sanity check on `str2` failed."))
+    {
+        return false;
+    }
+    if ((str1->flags ^ str2->flags) & STRING_OWNED)
+    {
+        __string_error(STRING_ERR_READONLY, "In string_swap: only one of the strings owns its buffer.");
+        return false;
+    }
+
+    //! Only the buffers change hands, nothing gets copied
+    char *   str1_val_backup   = str1->value;
+    size_t   str1_val_size     = str1->size;
+    size_t   str1_res_backup   = str1->reserved;
+    unsigned str1_flags_backup = str1->flags;
+
+    str1->value    = str2->value;
+    str1->size     = str2->size;
+    str1->reserved = str2->reserved;
+    str1->flags    = str2->flags;
+
+    str2->value    = str1_val_backup;
+    str2->size     = str1_val_size;
+    str2->reserved = str1_res_backup;
+    str2->flags    = str1_flags_backup;
+
+    return true;
+}
+
+//!
+//! \brief string_mid Returns a substring of a given string starting at position pos with a given length.
+//! \param str Source string for the substring.
+//! \param pos Position of the starting character.
+//! \param length Desired length of the substring. -1 for everything after pos.
+//! \return Generated substring.
+//!
+cstr_t * string_mid(cstr_t *str, size_t pos, long length)
+{
+    LIBSTRING_STATS_SCOPE(STRING_STAT_MID)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_mid: sanity check on `str` failed."))
+    {
+        return 0;
+    }
+
+    if (str->size <= pos || str->size == 0 || (length < 1 && length != -1))
+    {
+        return string_init("");
+    }
+
+    size_t stop_element;
+
+    if (length == -1)
+        stop_element = str->size;
+    else
+        stop_element = __cstr_min(str->size, pos + (size_t) length);
+
+    if (pos == 0 && stop_element == str->size)
+    {
+        return string_dup(str);     //! The whole string, so no need for a copy
+    }
+
+    return __string_from(&str->value[pos], stop_element - pos);
+}
+
+//!
+//! \brief string_left Returns the first (length) characters of a string starting from the left.
+//! \param str Source string for the substring.
+//! \param length Amount of characters desired.
+//! \return Generated substring.
+//!
+LIBSTRING_INLINE cstr_t * string_left(cstr_t *str, long length)
+{
+    return string_mid(str, 0, (long) length);
+}
+
+//!
+//! \brief string_left Returns the first (length) characters of a string starting from the right.
+//! \param str Source string for the substring.
+//! \param length Amount of characters desired.
+//! \return Generated substring.
+//!
+cstr_t * string_right(cstr_t *str, long length)
+{
+    size_t start_pos;
+    if ((unsigned) length >= str->size)
+    {
+        start_pos = 0;
+    }
+    else
+    {
+        start_pos = str->size - length;
+    }
+
+    return string_mid(str, start_pos, -1);
+}
+
+//! **** Splitting and joining **** !//
+
+/*!
+ * \struct split_header Stored right before the array returned by string_split_n.
+ * \property count    How many views follow the header.
+ * \property buffer   The buffer the views point into, whose reference is held until string_split_free. NULL if the
+ *                    split string did not own its buffer.
+ * \property reserved The capacity `buffer` was allocated with.
+ */
+struct split_header
+{
+    size_t count;
+    char * buffer;
+    size_t reserved;
+};
+
+//!
+//! \brief string_split_n Splits `str` at every occurrence of the first `delim_len` characters of `delim`.
+//! \param str            The string to be split.
+//! \param delim          The delimiter. It may contain NULs, but must not be empty.
+//! \param delim_len      The length of `delim`.
+//! \param count          Where to write the number of pieces to. May be NULL.
+//! \return               An array of views over the pieces (empty ones included), or NULL on failure. It must be
+//!                       freed with string_split_free.
+//! The views point straight into the buffer of `str`, which is shared until the array is freed (see string_dup),
+//! so they stay valid even if `str` gets modified or freed. The array itself is a single allocation.
+//!
+cstr_view_t * string_split_n(cstr_t * str, const char * delim, size_t delim_len, size_t * count)
+{
+    struct split_header * header;
+    cstr_view_t * parts;
+    const char * start, * end, * found;
+    size_t pieces = 1, i;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_SPLIT)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_split_n: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
+
+    if (!delim_len)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_split_n: `delim` must not be empty.");
+        return NULL;
+    }
+
+    //! Counting the pieces first lets the array be allocated once
+    start = str->value;
+    end   = str->value + str->size;
+    while ((found = __memmem(start, (size_t) (end - start), delim, delim_len)))
+    {
+        pieces++;
+        start = found + delim_len;
+    }
+
+    header = __malloc(sizeof(struct split_header) + pieces * sizeof(cstr_view_t));
+    if (!header)
+    {
+        return NULL;
+    }
+    header->count    = pieces;
+    header->buffer   = NULL;
+    header->reserved = 0;
+    if (str->flags & STRING_OWNED)
+    {
+        ++*__buf_refs(str->value);
+        header->buffer   = str->value;
+        header->reserved = str->reserved;
+    }
+
+    parts = (cstr_view_t *) (header + 1);
+    start = str->value;
+    for (i = 0; i + 1 < pieces; i++)
+    {
+        found = __memmem(start, (size_t) (end - start), delim, delim_len);
+        parts[i].value = start;
+        parts[i].size  = (size_t) (found - start);
+        start = found + delim_len;
+    }
+    parts[i].value = start;
+    parts[i].size  = (size_t) (end - start);
+
+    if (count)
+    {
+        *count = pieces;
+    }
+    return parts;
+}
+
+//!
+//! \brief string_split Splits `str` at every occurrence of `delim`.
+//! \param str          The string to be split.
+//! \param delim        The NUL-terminated delimiter. It must not be empty.
+//! \param count        Where to write the number of pieces to. May be NULL.
+//! \return             An array of views over the pieces, to be freed with string_split_free, or NULL on failure.
+//!
+cstr_view_t * string_split(cstr_t * str, const char * delim, size_t * count)
+{
+    return string_split_n(str, delim, __strlen(delim), count);
+}
+
+//!
+//! \brief string_split_view Splits `str` at every occurrence of `delim`.
+//! \return                  An array of views over the pieces, to be freed with string_split_free, or NULL on failure.
+//!
+cstr_view_t * string_split_view(cstr_t * str, cstr_view_t delim, size_t * count)
+{
+    return string_split_n(str, delim.value, delim.size, count);
+}
+
+//!
+//! \brief string_split_free Frees an array returned by string_split_n, and drops its reference to the split buffer.
+//! \param parts             The array, or NULL.
+//!
+void string_split_free(cstr_view_t * parts)
+{
+    struct split_header * header;
+
+    if (!parts)
+    {
+        return;
+    }
+
+    header = (struct split_header *) parts - 1;
+    if (header->buffer)
+    {
+        __buf_release(header->buffer, header->reserved);
+    }
+    __free(header, sizeof(struct split_header) + header->count * sizeof(cstr_view_t));
+}
+
+//!
+//! \brief string_join_n Joins `count` pieces into a new string, putting the first `sep_len` characters of `sep` between them.
+//! \param parts         The pieces to be joined, e.g. the ones returned by string_split_n.
+//! \param count         How many pieces there are.
+//! \param sep           The separator. It may contain NULs.
+//! \param sep_len       The length of `sep`.
+//! \return              A new cstr_t *, or NULL on failure.
+//! The total length is computed beforehand, so the result gets allocated once and written in a single pass.
+//!
+cstr_t * string_join_n(const cstr_view_t * parts, size_t count, const char * sep, size_t sep_len)
+{
+    cstr_t * joined;
+    char * dest;
+    size_t total = 0, i;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_JOIN)
+    if (count && !parts)
+    {
+        __string_error(STRING_ERR_NULL, "In string_join_n: `parts` is NULL.");
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        size_t add = parts[i].size + (i ? sep_len : 0);
+        if (add < parts[i].size || add >= (size_t) -1 - total)
+        {
+            __string_error(STRING_ERR_RANGE, "In string_join_n: the joined string would be too long.");
+            return NULL;
+        }
+        total += add;
+    }
+
+    joined = string_alloc(total + 1);
+    if (!joined)
+    {
+        return NULL;
+    }
+
+    dest = joined->value;
+    for (i = 0; i < count; i++)
+    {
+        if (i)
+        {
+            dest = __memcpy(dest, sep, sep_len);
+        }
+        dest = __memcpy(dest, parts[i].value, parts[i].size);
+    }
+    *dest = '\0';
+    joined->size = total;
+    return joined;
+}
+
+//!
+//! \brief string_join Joins `count` pieces into a new string, putting `sep` between them.
+//! \param parts       The pieces to be joined.
+//! \param count       How many pieces there are.
+//! \param sep         The NUL-terminated separator.
+//! \return            A new cstr_t *, or NULL on failure.
+//!
+cstr_t * string_join(const cstr_view_t * parts, size_t count, const char * sep)
+{
+    return string_join_n(parts, count, sep, __strlen(sep));
+}
+
+//! **** Regular expressions and globs **** !//
+//! Patterns are compiled to a Thompson NFA, which is turned into a DFA lazily while matching: every DFA
+//! state stands for the set of NFA states that could be active, and its transitions are only worked out
+//! the first time they are taken. Subjects are thus read once, from left to right, with no backtracking.
+//! Bytes that no pattern character tells apart share a column in the transition table.
+
+#define LIBSTRING_REGEX_MAX_NFA   65536
+#define LIBSTRING_REGEX_MAX_DFA   1024
+#define LIBSTRING_REGEX_MAX_DEPTH 256
+#define LIBSTRING_REGEX_UNBOUNDED ((size_t) -1)
+
+enum nfa_kind
+{
+    NFA_SET,        //! Consumes one of the bytes in `set`
+    NFA_SPLIT,      //! Goes on to both `out` and `out1` without consuming anything
+    NFA_EPS,        //! Goes on to `out` without consuming anything
+    NFA_MATCH
+};
+
+struct nfa_state
+{
+    unsigned char kind;
+    unsigned char set[32];
+    int out;
+    int out1;
+};
+
+/*!
+ * \struct nfa_frag A piece of NFA with a single way in (`start`) and a single way out (`end`, an NFA_EPS whose
+ *                  `out` is still unset).
+ */
+struct nfa_frag
+{
+    int start;
+    int end;
+};
+
+/*!
+ * \struct dfa_state A DFA state, i.e. a set of NFA states.
+ * \property set_start Where its NFA states (only the NFA_SET and NFA_MATCH ones, sorted) start in `dfa_sets`.
+ * \property set_len   How many there are. Zero means no match can be found from here on.
+ * \property match     Whether one of them is NFA_MATCH.
+ */
+struct dfa_state
+{
+    size_t set_start;
+    size_t set_len;
+    bool   match;
+};
+
+struct string_regex
+{
+    struct nfa_state * nfa;
+    size_t             nfa_len;
+    size_t             nfa_cap;
+    int                start;
+    bool               anchored_start;
+    bool               anchored_end;
+    char             * prefix;              //! Every match starts with these characters
+    size_t             prefix_len;
+    unsigned char      class_of[256];       //! The transition table column of every byte
+    size_t             classes;
+    int              * start_set;
+    size_t             start_len;
+    struct dfa_state * dfa;                 //! Up to LIBSTRING_REGEX_MAX_DFA states, flushed once that is reached
+    int              * dfa_next;            //! dfa_next[state * classes + column], -1 until worked out
+    size_t             dfa_len;
+    size_t             dfa_cap;
+    size_t             dfa_next_cap;
+    int              * dfa_sets;
+    size_t             dfa_sets_len;
+    size_t             dfa_sets_cap;
+    int              * dfa_hash;            //! 2 * LIBSTRING_REGEX_MAX_DFA slots, -1 when empty
+    unsigned         * marks;               //! Scratch space used to work out sets of NFA states
+    unsigned           mark;
+    int              * stack;
+    int              * scratch;
+};
+
+struct regex_parser
+{
+    string_regex_t * re;
+    const char     * pattern;
+    size_t           len;
+    size_t           pos;
+    int              depth;
+    bool             glob;
+    bool             top_alternation;
+    enum string_error code;
+    const char     * error;
+};
+
+static struct nfa_frag __frag_fail(void)
+{
+    struct nfa_frag frag;
+    frag.start = frag.end = -1;
+    return frag;
+}
+
+//!
+//! \brief __regex_fail Records why a pattern could not be compiled.
+//! \return             A fragment telling the callers to give up.
+//!
+static struct nfa_frag __regex_fail(struct regex_parser * p, enum string_error code, const char * error)
+{
+    if (!p->error)
+    {
+        p->code  = code;
+        p->error = error;
+    }
+    return __frag_fail();
+}
+
+static LIBSTRING_INLINE void __set_add(unsigned char * set, unsigned char byte)
+{
+    set[byte >> 3] |= (unsigned char) (1u << (byte & 7));
+}
+
+static LIBSTRING_INLINE bool __set_has(const unsigned char * set, unsigned char byte)
+{
+    return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+static void __set_add_range(unsigned char * set, unsigned char lo, unsigned char hi)
+{
+    unsigned b;
+    for (b = lo; b <= hi; b++)
+    {
+        __set_add(set, (unsigned char) b);
+    }
+}
+
+//!
+//! \brief __nfa_add Appends a state to the NFA.
+//! \return          Its index, or -1 (with p->error set) if the NFA would get too big or allocation failed.
+//!
+static int __nfa_add(struct regex_parser * p, enum nfa_kind kind, int out, int out1)
+{
+    string_regex_t * re = p->re;
+    struct nfa_state * state;
+
+    if (re->nfa_len == re->nfa_cap)
+    {
+        struct nfa_state * grown;
+        if (re->nfa_cap == LIBSTRING_REGEX_MAX_NFA)
+        {
+            __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: it is too big.");
+            return -1;
+        }
+        grown = __realloc(re->nfa, re->nfa_cap * sizeof(struct nfa_state), 2 * re->nfa_cap * sizeof(struct nfa_state));
+        if (!grown)
+        {
+            __regex_fail(p, STRING_ERR_ALLOC, "Invalid pattern: there was no memory left to compile it.");
+            return -1;
+        }
+        re->nfa = grown;
+        re->nfa_cap *= 2;
+    }
+
+    state = &re->nfa[re->nfa_len];
+    state->kind = (unsigned char) kind;
+    state->out  = out;
+    state->out1 = out1;
+    return (int) re->nfa_len++;
+}
+
+static struct nfa_frag __frag_empty(struct regex_parser * p)
+{
+    struct nfa_frag frag;
+    frag.start = frag.end = __nfa_add(p, NFA_EPS, -1, -1);
+    return frag;
+}
+
+static struct nfa_frag __frag_set(struct regex_parser * p, const unsigned char * set)
+{
+    struct nfa_frag frag;
+    size_t i;
+
+    frag.end = __nfa_add(p, NFA_EPS, -1, -1);
+    if (frag.end < 0 || (frag.start = __nfa_add(p, NFA_SET, frag.end, -1)) < 0)
+    {
+        return __frag_fail();
+    }
+    for (i = 0; i < 32; i++)
+    {
+        p->re->nfa[frag.start].set[i] = set[i];
+    }
+    return frag;
+}
+
+static struct nfa_frag __frag_cat(struct nfa_frag a, struct nfa_frag b, struct regex_parser * p)
+{
+    p->re->nfa[a.end].out = b.start;
+    a.end = b.end;
+    return a;
+}
+
+static struct nfa_frag __frag_alt(struct nfa_frag a, struct nfa_frag b, struct regex_parser * p)
+{
+    struct nfa_frag frag;
+
+    frag.end = __nfa_add(p, NFA_EPS, -1, -1);
+    if (frag.end < 0 || (frag.start = __nfa_add(p, NFA_SPLIT, a.start, b.start)) < 0)
+    {
+        return __frag_fail();
+    }
+    p->re->nfa[a.end].out = frag.end;
+    p->re->nfa[b.end].out = frag.end;
+    return frag;
+}
+
+//!
+//! \brief __frag_repeat Applies a quantifier to `a`.
+//! \param c             '*' (zero or more), '+' (one or more) or '?' (zero or one).
+//!
+static struct nfa_frag __frag_repeat(struct nfa_frag a, char c, struct regex_parser * p)
+{
+    struct nfa_frag frag;
+    int split;
+
+    frag.end = __nfa_add(p, NFA_EPS, -1, -1);
+    if (frag.end < 0 || (split = __nfa_add(p, NFA_SPLIT, a.start, frag.end)) < 0)
+    {
+        return __frag_fail();
+    }
+    p->re->nfa[a.end].out = c == '?' ? frag.end : split;
+    frag.start = c == '+' ? a.start : split;
+    return frag;
+}
+
+//!
+//! \brief __regex_escape Adds the bytes matched by the escape sequence `\c` to `set`.
+//!
+static void __regex_escape(unsigned char * set, char c)
+{
+    unsigned char bytes[32] = { 0 };
+    bool negate = c == 'D' || c == 'W' || c == 'S';
+    size_t i;
+
+    switch (c)
+    {
+    case 'd': case 'D':
+        __set_add_range(bytes, '0', '9');
+        break;
+    case 'w': case 'W':
+        __set_add_range(bytes, '0', '9');
+        __set_add_range(bytes, 'A', 'Z');
+        __set_add_range(bytes, 'a', 'z');
+        __set_add(bytes, '_');
+        break;
+    case 's': case 'S':
+        __set_add_range(bytes, '\t', '\r');
+        __set_add(bytes, ' ');
+        break;
+    case 'n':
+        __set_add(bytes, '\n');
+        break;
+    case 't':
+        __set_add(bytes, '\t');
+        break;
+    case 'r':
+        __set_add(bytes, '\r');
+        break;
+    default:
+        __set_add(bytes, (unsigned char) c);
+    }
+
+    for (i = 0; i < 32; i++)
+    {
+        set[i] |= (unsigned char) (negate ? ~bytes[i] : bytes[i]);
+    }
+}
+
+//!
+//! \brief __regex_parse_class Parses a bracket expression such as `[a-z_]`, `[^0-9]` or (in globs) `[!.]`.
+//! `p->pos` is right after the '['.
+//!
+static struct nfa_frag __regex_parse_class(struct regex_parser * p)
+{
+    unsigned char set[32] = { 0 };
+    bool negate = false, first = true;
+    size_t i;
+
+    if (p->pos < p->len && (p->pattern[p->pos] == '^' || (p->glob && p->pattern[p->pos] == '!')))
+    {
+        negate = true;
+        p->pos++;
+    }
+
+    while (p->pos < p->len && (first || p->pattern[p->pos] != ']'))
+    {
+        unsigned char lo = (unsigned char) p->pattern[p->pos++], hi;
+        first = false;
+
+        if (lo == '\\')
+        {
+            if (p->pos == p->len)
+            {
+                break;
+            }
+            lo = (unsigned char) p->pattern[p->pos++];
+            if (!p->glob && (lo == 'd' || lo == 'D' || lo == 'w' || lo == 'W' || lo == 's' || lo == 'S'))
+            {
+                __regex_escape(set, (char) lo);
+                continue;
+            }
+        }
+
+        hi = lo;
+        if (p->pos + 1 < p->len && p->pattern[p->pos] == '-' && p->pattern[p->pos + 1] != ']')
+        {
+            hi = (unsigned char) p->pattern[p->pos + 1];
+            p->pos += 2;
+            if (hi == '\\' && p->pos < p->len)
+            {
+                hi = (unsigned char) p->pattern[p->pos++];
+            }
+            if (hi < lo)
+            {
+                return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: invalid range in a bracket expression.");
+            }
+        }
+        __set_add_range(set, lo, hi);
+    }
+
+    if (p->pos == p->len)
+    {
+        return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: missing `]`.");
+    }
+    p->pos++;
+
+    if (negate)
+    {
+        for (i = 0; i < 32; i++)
+        {
+            set[i] = (unsigned char) ~set[i];
+        }
+    }
+    return __frag_set(p, set);
+}
+
+static struct nfa_frag __regex_parse_alternation(struct regex_parser * p);
+
+//!
+//! \brief __regex_parse_atom Parses a single character, escape sequence, bracket expression or parenthesized group.
+//!
+static struct nfa_frag __regex_parse_atom(struct regex_parser * p)
+{
+    unsigned char set[32] = { 0 };
+    char c = p->pattern[p->pos++];
+    struct nfa_frag frag;
+
+    switch (c)
+    {
+    case '(':
+        if (++p->depth > LIBSTRING_REGEX_MAX_DEPTH)
+        {
+            return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: too many nested groups.");
+        }
+        frag = __regex_parse_alternation(p);
+        if (frag.start < 0)
+        {
+            return frag;
+        }
+        if (p->pos == p->len || p->pattern[p->pos] != ')')
+        {
+            return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: missing `)`.");
+        }
+        p->pos++;
+        p->depth--;
+        return frag;
+    case '*': case '+': case '?':
+        return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: nothing to repeat.");
+    case '^': case '$':
+        return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: `^` and `$` are only supported at the start and end of the pattern.");
+    case '[':
+        return __regex_parse_class(p);
+    case '.':
+        __set_add_range(set, 0, 255);
+        set['\n' >> 3] &= (unsigned char) ~(1u << ('\n' & 7));
+        return __frag_set(p, set);
+    case '\\':
+        if (p->pos == p->len)
+        {
+            return __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: trailing `\\`.");
+        }
+        __regex_escape(set, p->pattern[p->pos++]);
+        return __frag_set(p, set);
+    default:
+        __set_add(set, (unsigned char) c);
+        return __frag_set(p, set);
+    }
+}
+
+//!
+//! \brief __regex_parse_count Parses a counted repetition such as `{2}`, `{2,}` or `{2,5}`, at `p->pos`.
+//! \return                    False, leaving `p->pos` untouched, if there is none (the '{' is then a literal).
+//!
+static bool __regex_parse_count(struct regex_parser * p, size_t * min, size_t * max)
+{
+    size_t pos = p->pos + 1;
+    bool has_max = false;
+
+    *min = *max = 0;
+    if (pos == p->len || p->pattern[pos] < '0' || p->pattern[pos] > '9')
+    {
+        return false;
+    }
+    while (pos < p->len && p->pattern[pos] >= '0' && p->pattern[pos] <= '9' && *min <= 1000)
+    {
+        *min = *min * 10 + (size_t) (p->pattern[pos++] - '0');
+    }
+    *max = *min;
+    if (pos < p->len && p->pattern[pos] == ',')
+    {
+        pos++;
+        *max = LIBSTRING_REGEX_UNBOUNDED;
+        while (pos < p->len && p->pattern[pos] >= '0' && p->pattern[pos] <= '9' && (!has_max || *max <= 1000))
+        {
+            *max = (has_max ? *max * 10 : 0) + (size_t) (p->pattern[pos++] - '0');
+            has_max = true;
+        }
+    }
+    if (pos == p->len || p->pattern[pos] != '}')
+    {
+        return false;
+    }
+    if (*min > 1000 || (has_max && *max > 1000) || *max < *min)
+    {
+        __regex_fail(p, STRING_ERR_RANGE, "Invalid pattern: invalid counted repetition.");
+        return false;
+    }
+    p->pos = pos + 1;
+    return true;
+}
+
+//!
+//! \brief __regex_parse_repeat Parses an atom and the quantifiers that follow it, as long as they start before `stop`.
+//! Counted repetitions are built by parsing the quantified part again for every copy.
+//!
+static struct nfa_frag __regex_parse_repeat(struct regex_parser * p, size_t stop)
+{
+    size_t atom_pos = p->pos;
+    struct nfa_frag frag = __regex_parse_atom(p);
+
+    while (frag.start >= 0 && p->pos < stop && p->pos < p->len)
+    {
+        char c = p->pattern[p->pos];
+        size_t min, max, brace_pos = p->pos, copies, i;
+        struct nfa_frag result = frag;
+
+        if (c == '*' || c == '+' || c == '?')
+        {
+            p->pos++;
+            frag = __frag_repeat(frag, c, p);
+            continue;
+        }
+        if (c != '{' || !__regex_parse_count(p, &min, &max))
+        {
+            return p->error ? __frag_fail() : frag;
+        }
+
+        //! x{2,4} is xxx?x?, x{2,} is xx+, x{0,} is x*
+        copies = max == LIBSTRING_REGEX_UNBOUNDED ? (min ? min : 1) : max;
+        if (!copies)
+        {
+            frag = __frag_empty(p);
+            continue;
+        }
+        for (i = 0; i < copies && result.start >= 0; i++)
+        {
+            size_t brace_end = p->pos;
+            struct nfa_frag copy = frag;
+            if (i)
+            {
+                p->pos = atom_pos;
+                copy = __regex_parse_repeat(p, brace_pos);
+                p->pos = brace_end;
+                if (copy.start < 0)
+                {
+                    return copy;
+                }
+            }
+            if (max == LIBSTRING_REGEX_UNBOUNDED && i == copies - 1)
+            {
+                copy = __frag_repeat(copy, min ? '+' : '*', p);
+            }
+            else if (i >= min)
+            {
+                copy = __frag_repeat(copy, '?', p);
+            }
+            if (copy.start < 0)
+            {
+                return copy;
+            }
+            result = i ? __frag_cat(result, copy, p) : copy;
+        }
+        frag = result;
+    }
+    return frag;
+}
+
+static struct nfa_frag __regex_parse_concatenation(struct regex_parser * p)
+{
+    struct nfa_frag frag;
+    bool empty = true;
+
+    while (p->pos < p->len && p->pattern[p->pos] != '|' && p->pattern[p->pos] != ')')
+    {
+        struct nfa_frag next = __regex_parse_repeat(p, LIBSTRING_REGEX_UNBOUNDED);
+        if (next.start < 0)
+        {
+            return next;
+        }
+        frag = empty ? next : __frag_cat(frag, next, p);
+        empty = false;
+    }
+    return empty ? __frag_empty(p) : frag;
+}
+
+static struct nfa_frag __regex_parse_alternation(struct regex_parser * p)
+{
+    struct nfa_frag frag = __regex_parse_concatenation(p);
+
+    while (frag.start >= 0 && p->pos < p->len && p->pattern[p->pos] == '|')
+    {
+        struct nfa_frag next;
+        p->top_alternation = p->top_alternation || !p->depth;
+        p->pos++;
+        next = __regex_parse_concatenation(p);
+        frag = next.start < 0 ? next : __frag_alt(frag, next, p);
+    }
+    return frag;
+}
+
+//!
+//! \brief __glob_parse Parses a glob: `*` matches any run of characters, `?` any single one, `[...]` any one in
+//!                     the set (`[!...]` any one not in it), and `\` escapes the next character.
+//!
+static struct nfa_frag __glob_parse(struct regex_parser * p)
+{
+    struct nfa_frag frag = __frag_empty(p);
+
+    while (frag.start >= 0 && p->pos < p->len)
+    {
+        unsigned char set[32] = { 0 };
+        struct nfa_frag next;
+        char c = p->pattern[p->pos++];
+
+        if (c == '[')
+        {
+            next = __regex_parse_class(p);
+        }
+        else if (c == '*' || c == '?')
+        {
+            __set_add_range(set, 0, 255);
+            next = __frag_set(p, set);
+            if (c == '*' && next.start >= 0)
+            {
+                next = __frag_repeat(next, '*', p);
+            }
+        }
+        else
+        {
+            if (c == '\\' && p->pos < p->len)
+            {
+                c = p->pattern[p->pos++];
+            }
+            __set_add(set, (unsigned char) c);
+            next = __frag_set(p, set);
+        }
+        frag = next.start < 0 ? next : __frag_cat(frag, next, p);
+    }
+    return frag;
+}
+
+//!
+//! \brief __regex_closure Marks `state` and every state reachable from it without consuming anything.
+//!
+static void __regex_closure(string_regex_t * re, int state)
+{
+    size_t top = 0;
+
+    if (re->marks[state] == re->mark)
+    {
+        return;
+    }
+    re->marks[state] = re->mark;
+    re->stack[top++] = state;
+    while (top)
+    {
+        const struct nfa_state * current = &re->nfa[re->stack[--top]];
+        if (current->kind == NFA_SPLIT || current->kind == NFA_EPS)
+        {
+            if (re->marks[current->out] != re->mark)
+            {
+                re->marks[current->out] = re->mark;
+                re->stack[top++] = current->out;
+            }
+            if (current->kind == NFA_SPLIT && re->marks[current->out1] != re->mark)
+            {
+                re->marks[current->out1] = re->mark;
+                re->stack[top++] = current->out1;
+            }
+        }
+    }
+}
+
+static void __regex_next_mark(string_regex_t * re)
+{
+    if (!++re->mark)
+    {
+        size_t i;
+        for (i = 0; i < re->nfa_len; i++)
+        {
+            re->marks[i] = 0;
+        }
+        re->mark = 1;
+    }
+}
+
+//!
+//! \brief __regex_collect Writes the marked NFA_SET and NFA_MATCH states to `re->scratch`, in order.
+//! \return                How many there are.
+//!
+static size_t __regex_collect(string_regex_t * re)
+{
+    size_t i, n = 0;
+    for (i = 0; i < re->nfa_len; i++)
+    {
+        if (re->marks[i] == re->mark && (re->nfa[i].kind == NFA_SET || re->nfa[i].kind == NFA_MATCH))
+        {
+            re->scratch[n++] = (int) i;
+        }
+    }
+    return n;
+}
+
+//!
+//! \brief __dfa_intern Finds the DFA state for the given set of NFA states, adding it if needed.
+//! \return             Its index, -1 if the DFA is full or -2 if allocation failed.
+//!
+static int __dfa_intern(string_regex_t * re, const int * set, size_t len)
+{
+    size_t hash = 2166136261u, slot, i;
+    const size_t slots = 2 * LIBSTRING_REGEX_MAX_DFA;
+    struct dfa_state * state;
+
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash ^ (size_t) set[i]) * 16777619u;
+    }
+    for (slot = hash % slots; re->dfa_hash[slot] >= 0; slot = (slot + 1) % slots)
+    {
+        state = &re->dfa[re->dfa_hash[slot]];
+        if (state->set_len == len)
+        {
+            i = 0;
+            while (i < len && re->dfa_sets[state->set_start + i] == set[i])
+            {
+                i++;
+            }
+            if (i == len)
+            {
+                return re->dfa_hash[slot];
+            }
+        }
+    }
+
+    if (re->dfa_len == LIBSTRING_REGEX_MAX_DFA)
+    {
+        return -1;
+    }
+    if (re->dfa_len == re->dfa_cap)
+    {
+        struct dfa_state * dfa = __realloc(re->dfa, re->dfa_cap * sizeof(struct dfa_state), 2 * re->dfa_cap * sizeof(struct dfa_state));
+        if (!dfa)
+        {
+            return -2;
+        }
+        re->dfa = dfa;
+        re->dfa_cap *= 2;
+    }
+    if (re->dfa_len == re->dfa_next_cap)
+    {
+        size_t row = re->classes * sizeof(int);
+        int * next = __realloc(re->dfa_next, re->dfa_next_cap * row, 2 * re->dfa_next_cap * row);
+        if (!next)
+        {
+            return -2;
+        }
+        re->dfa_next = next;
+        re->dfa_next_cap *= 2;
+    }
+    if (re->dfa_sets_cap - re->dfa_sets_len < len)
+    {
+        size_t cap = re->dfa_sets_cap;
+        int * sets;
+        while (cap - re->dfa_sets_len < len)
+        {
+            cap *= 2;
+        }
+        sets = __realloc(re->dfa_sets, re->dfa_sets_cap * sizeof(int), cap * sizeof(int));
+        if (!sets)
+        {
+            return -2;
+        }
+        re->dfa_sets = sets;
+        re->dfa_sets_cap = cap;
+    }
+
+    state = &re->dfa[re->dfa_len];
+    state->set_start = re->dfa_sets_len;
+    state->set_len   = len;
+    state->match     = false;
+    for (i = 0; i < len; i++)
+    {
+        re->dfa_sets[re->dfa_sets_len++] = set[i];
+        state->match = state->match || re->nfa[set[i]].kind == NFA_MATCH;
+    }
+    for (i = 0; i < re->classes; i++)
+    {
+        re->dfa_next[re->dfa_len * re->classes + i] = -1;
+    }
+    re->dfa_hash[slot] = (int) re->dfa_len;
+    return (int) re->dfa_len++;
+}
+
+//!
+//! \brief __dfa_flush Throws every DFA state away but the start state, which gets index 0 again.
+//! \return            False if allocation failed.
+//!
+static bool __dfa_flush(string_regex_t * re)
+{
+    size_t i;
+
+    re->dfa_len = 0;
+    re->dfa_sets_len = 0;
+    for (i = 0; i < 2 * LIBSTRING_REGEX_MAX_DFA; i++)
+    {
+        re->dfa_hash[i] = -1;
+    }
+    return __dfa_intern(re, re->start_set, re->start_len) == 0;
+}
+
+//!
+//! \brief __dfa_step Works out the transition from `state` on `byte`, and caches it.
+//! \return           The next state, or -1 if allocation failed. Every state but the start one is forgotten
+//!                   when the DFA gets full, so the returned index may belong to a fresh DFA.
+//!
+static int __dfa_step(string_regex_t * re, int state, unsigned char byte)
+{
+    size_t i, len;
+    int next;
+
+    __regex_next_mark(re);
+    for (i = 0; i < re->dfa[state].set_len; i++)
+    {
+        const struct nfa_state * nfa = &re->nfa[re->dfa_sets[re->dfa[state].set_start + i]];
+        if (nfa->kind == NFA_SET && __set_has(nfa->set, byte))
+        {
+            __regex_closure(re, nfa->out);
+        }
+    }
+    if (!re->anchored_start)
+    {
+        __regex_closure(re, re->start);     //! A match may start anywhere
+    }
+    len = __regex_collect(re);
+
+    next = __dfa_intern(re, re->scratch, len);
+    if (next == -1)
+    {
+        //! `state` is gone, so there's nowhere to cache the transition in
+        next = __dfa_flush(re) ? __dfa_intern(re, re->scratch, len) : -2;
+    }
+    else if (next >= 0)
+    {
+        re->dfa_next[(size_t) state * re->classes + re->class_of[byte]] = next;
+    }
+    if (next < 0)
+    {
+        __string_error(STRING_ERR_ALLOC, "In string_regex_match: the DFA could not be grown.");
+        return -1;
+    }
+    return next;
+}
+
+//! Compiled patterns may be missing some of their arrays if compiling failed halfway
+static void __regex_release(void * ptr, size_t size)
+{
+    if (ptr)
+    {
+        __free(ptr, size);
+    }
+}
+
+//!
+//! \brief string_regex_free Frees a compiled pattern.
+//! \param re                The pattern, or NULL.
+//!
+void string_regex_free(string_regex_t * re)
+{
+    if (!re)
+    {
+        return;
+    }
+    __regex_release(re->nfa, re->nfa_cap * sizeof(struct nfa_state));
+    __regex_release(re->prefix, re->prefix_len + 1);
+    __regex_release(re->start_set, (re->start_len + 1) * sizeof(int));
+    __regex_release(re->dfa, re->dfa_cap * sizeof(struct dfa_state));
+    __regex_release(re->dfa_next, re->dfa_next_cap * re->classes * sizeof(int));
+    __regex_release(re->dfa_sets, re->dfa_sets_cap * sizeof(int));
+    __regex_release(re->dfa_hash, 2 * LIBSTRING_REGEX_MAX_DFA * sizeof(int));
+    __regex_release(re->marks, re->nfa_len * sizeof(unsigned));
+    __regex_release(re->stack, re->nfa_len * sizeof(int));
+    __regex_release(re->scratch, re->nfa_len * sizeof(int));
+    __free(re, sizeof(string_regex_t));
+}
+
+//!
+//! \brief __regex_prefix Follows the NFA from its start for as long as there is a single byte it can consume.
+//! \param out            Where to write those bytes to, or NULL to just count them.
+//! \return               How many bytes every match has to start with.
+//!
+static size_t __regex_prefix(const string_regex_t * re, char * out)
+{
+    size_t len = 0, steps;
+    int state = re->start;
+
+    for (steps = 0; steps < re->nfa_len; steps++)
+    {
+        const struct nfa_state * current = &re->nfa[state];
+        unsigned b, found = 0, count = 0;
+
+        if (current->kind == NFA_EPS)
+        {
+            state = current->out;
+            continue;
+        }
+        if (current->kind != NFA_SET)
+        {
+            break;
+        }
+        for (b = 0; b < 256 && count < 2; b++)
+        {
+            if (__set_has(current->set, (unsigned char) b))
+            {
+                found = b;
+                count++;
+            }
+        }
+        if (count != 1)
+        {
+            break;
+        }
+        if (out)
+        {
+            out[len] = (char) found;
+        }
+        len++;
+        state = current->out;
+    }
+    return len;
+}
+
+//!
+//! \brief __regex_compile Compiles a regular expression or a glob.
+//! \return                The compiled pattern, or NULL (after reporting why) on failure.
+//!
+static string_regex_t * __regex_compile(const char * pattern, bool glob, const char * where)
+{
+    static const string_regex_t empty_regex;
+    unsigned char boundary[256] = { 0 };
+    struct regex_parser p;
+    struct nfa_frag frag;
+    string_regex_t * re;
+    size_t i;
+    int match;
+
+    if (!pattern)
+    {
+        __string_error(STRING_ERR_NULL, where);
+        return NULL;
+    }
+
+    re = __malloc(sizeof(string_regex_t));
+    if (!re)
+    {
+        return NULL;
+    }
+    *re = empty_regex;
+    re->nfa_cap = 16;
+    re->nfa = __malloc(re->nfa_cap * sizeof(struct nfa_state));
+    if (!re->nfa)
+    {
+        re->nfa_cap = 0;
+        string_regex_free(re);
+        return NULL;
+    }
+
+    p.re              = re;
+    p.pattern         = pattern;
+    p.len             = __strlen(pattern);
+    p.pos             = 0;
+    p.depth           = 0;
+    p.glob            = glob;
+    p.top_alternation = false;
+    p.code            = STRING_OK;
+    p.error           = NULL;
+
+    if (glob)
+    {
+        re->anchored_start = re->anchored_end = true;
+        frag = __glob_parse(&p);
+    }
+    else
+    {
+        size_t backslashes = 0;
+        if (p.len && pattern[0] == '^')
+        {
+            re->anchored_start = true;
+            p.pos++;
+        }
+        while (backslashes + 1 < p.len && pattern[p.len - 2 - backslashes] == '\\')
+        {
+            backslashes++;
+        }
+        if (p.len > p.pos && pattern[p.len - 1] == '$' && backslashes % 2 == 0)
+        {
+            re->anchored_end = true;
+            p.len--;
+        }
+        frag = __regex_parse_alternation(&p);
+        if (frag.start >= 0 && p.pos < p.len)
+        {
+            frag = __regex_fail(&p, STRING_ERR_RANGE, "Invalid pattern: unmatched `)`.");
+        }
+        if (frag.start >= 0 && p.top_alternation && (re->anchored_start || re->anchored_end))
+        {
+            frag = __regex_fail(&p, STRING_ERR_RANGE, "Invalid pattern: anchored alternatives must be put between parentheses.");
+        }
+    }
+
+    if (frag.start < 0 || (match = __nfa_add(&p, NFA_MATCH, -1, -1)) < 0)
+    {
+        __string_error(p.code, p.error);
+        string_regex_free(re);
+        return NULL;
+    }
+    re->nfa[frag.end].out = match;
+    re->start = frag.start;
+
+    //! Bytes go in the same column unless some NFA_SET tells them apart
+    for (i = 0; i < re->nfa_len; i++)
+    {
+        unsigned b;
+        if (re->nfa[i].kind != NFA_SET)
+        {
+            continue;
+        }
+        for (b = 1; b < 256; b++)
+        {
+            if (__set_has(re->nfa[i].set, (unsigned char) b) != __set_has(re->nfa[i].set, (unsigned char) (b - 1)))
+            {
+                boundary[b] = 1;
+            }
+        }
+    }
+    re->classes = 1;
+    for (i = 1; i < 256; i++)
+    {
+        re->classes += boundary[i];
+        re->class_of[i] = (unsigned char) (re->classes - 1);
+    }
+
+    re->prefix_len = __regex_prefix(re, NULL);
+    re->prefix     = __malloc(re->prefix_len + 1);
+    re->marks      = __malloc(re->nfa_len * sizeof(unsigned));
+    re->stack      = __malloc(re->nfa_len * sizeof(int));
+    re->scratch    = __malloc(re->nfa_len * sizeof(int));
+    re->dfa_hash   = __malloc(2 * LIBSTRING_REGEX_MAX_DFA * sizeof(int));
+    re->dfa_cap = re->dfa_next_cap = 16;
+    re->dfa        = __malloc(re->dfa_cap * sizeof(struct dfa_state));
+    re->dfa_next   = __malloc(re->dfa_next_cap * re->classes * sizeof(int));
+    re->dfa_sets_cap = 64;
+    re->dfa_sets   = __malloc(re->dfa_sets_cap * sizeof(int));
+    if (!re->prefix || !re->marks || !re->stack || !re->scratch || !re->dfa_hash || !re->dfa || !re->dfa_next || !re->dfa_sets)
+    {
+        string_regex_free(re);
+        return NULL;
+    }
+    __regex_prefix(re, re->prefix);
+    re->prefix[re->prefix_len] = '\0';
+
+    for (i = 0; i < re->nfa_len; i++)
+    {
+        re->marks[i] = 0;
+    }
+    re->mark = 0;
+    __regex_next_mark(re);
+    __regex_closure(re, re->start);
+    re->start_len = __regex_collect(re);
+    re->start_set = __malloc((re->start_len + 1) * sizeof(int));
+    if (!re->start_set)
+    {
+        string_regex_free(re);
+        return NULL;
+    }
+    for (i = 0; i < re->start_len; i++)
+    {
+        re->start_set[i] = re->scratch[i];
+    }
+
+    if (!__dfa_flush(re))
+    {
+        string_regex_free(re);
+        return NULL;
+    }
+    return re;
+}
+
+//!
+//! \brief string_regex_compile Compiles a regular expression.
+//! \param pattern              The expression. It supports `.`, `[...]` and `[^...]`, `\d`, `\w`, `\s` (and their
+//!                             negations `\D`, `\W`, `\S`), groups, `|`, and the `*`, `+`, `?` and `{m,n}`
+//!                             quantifiers. `^` and `$` may only anchor the start and end of the whole pattern.
+//! \return                     The compiled expression, to be freed with string_regex_free, or NULL on failure.
+//!
+string_regex_t * string_regex_compile(const char * pattern)
+{
+    return __regex_compile(pattern, false, "In string_regex_compile: `pattern` is NULL.");
+}
+
+//!
+//! \brief string_glob_compile Compiles a glob, which has to match the whole string.
+//! \param pattern             The glob. `*` matches any run of characters (slashes included), `?` any single
+//!                            character, `[...]` any one in the set and `[!...]` any one not in it. `\` escapes
+//!                            the next character.
+//! \return                    The compiled glob, to be freed with string_regex_free, or NULL on failure.
+//!
+string_regex_t * string_glob_compile(const char * pattern)
+{
+    return __regex_compile(pattern, true, "In string_glob_compile: `pattern` is NULL.");
+}
+
+//!
+//! \brief string_regex_match_view Verifies if a compiled pattern matches `str` (anywhere in it, for an expression
+//!                                that is not anchored).
+//! \param re                      A pattern compiled by string_regex_compile or string_glob_compile.
+//! \param str                     The characters to be matched. They may contain NULs.
+//! \return                        True if there is a match.
+//! Every character is read at most once. While no match is under way, the search skips straight to the next
+//! occurrence of the characters every match has to start with, if there are any.
+//!
+bool string_regex_match_view(string_regex_t * re, cstr_view_t str)
+{
+    const unsigned char * text = (const unsigned char *) str.value;
+    size_t i = 0;
+    int state = 0;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_REGEX_MATCH)
+    if (!re)
+    {
+        __string_error(STRING_ERR_NULL, "In string_regex_match: `re` is NULL.");
+        return false;
+    }
+
+    if (re->anchored_start && re->prefix_len
+        && (str.size < re->prefix_len || !__memeq((char *) str.value, re->prefix, re->prefix_len)))
+    {
+        return false;
+    }
+    if (re->dfa[0].match && !re->anchored_end)
+    {
+        return true;
+    }
+
+    while (i < str.size)
+    {
+        int next;
+
+        if (!state && re->prefix_len && !re->anchored_start)
+        {
+            //! Nothing is under way, so nothing can match before the next occurrence of the prefix
+            const char * found = __memmem(str.value + i, str.size - i, re->prefix, re->prefix_len);
+            if (!found)
+            {
+                return false;
+            }
+            i = (size_t) (found - str.value);
+        }
+
+        next = re->dfa_next[(size_t) state * re->classes + re->class_of[text[i]]];
+        if (next < 0 && (next = __dfa_step(re, state, text[i])) < 0)
+        {
+            return false;
+        }
+        state = next;
+        i++;
+
+        if (re->dfa[state].match && !re->anchored_end)
+        {
+            return true;
+        }
+        if (!re->dfa[state].set_len)
+        {
+            return false;
+        }
+    }
+    return re->dfa[state].match;
+}
+
+//!
+//! \brief string_regex_match Verifies if a compiled pattern matches `str`.
+//! \param re                 A pattern compiled by string_regex_compile or string_glob_compile.
+//! \param str                The string to be matched.
+//! \return                   True if there is a match.
+//!
+bool string_regex_match(string_regex_t * re, cstr_t * str)
+{
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_regex_match: sanity check on `str` failed."))
+    {
+        return false;
+    }
+    return string_regex_match_view(re, string_view(str));
+}
+
+//! **** Full-text index **** !//
+//! A suffix array lists the positions of a text in the order of the suffixes starting at them, so the
+//! occurrences of any pattern sit next to each other and can be found by binary search. It is built in
+//! linear time with SA-IS (Nong, Zhang & Chan, 2009).
+
+#define LIBSTRING_SAIS_EMPTY ((size_t) -1)
+#define LIBSTRING_INDEX_MAGIC "LSIX"
+#define LIBSTRING_INDEX_VERSION 1
+
+/*!
+ * \struct string_index A suffix array over a text.
+ * \property text     The indexed characters, followed by a NUL-terminator.
+ * \property size     How many there are.
+ * \property sa       The size + 1 suffixes in order, the empty one (at `size`) first.
+ * \property buffer   The reference-counted buffer `text` lives in, NULL if the indexed string did not own it.
+ * \property reserved The capacity `buffer` was allocated with.
+ */
+struct string_index
+{
+    const char * text;
+    size_t       size;
+    size_t     * sa;
+    char       * buffer;
+    size_t       reserved;
+};
+
+static LIBSTRING_INLINE size_t __sais_chr(const void * s, size_t i, bool wide)
+{
+    return wide ? ((const size_t *) s)[i] : ((const unsigned char *) s)[i];
+}
+
+//! Whether the suffix at `i` is S-type, i.e. smaller than the one at `i + 1`
+static LIBSTRING_INLINE bool __sais_is_s(const unsigned char * types, size_t i)
+{
+    return (types[i >> 3] >> (i & 7)) & 1;
+}
+
+static LIBSTRING_INLINE void __sais_set_type(unsigned char * types, size_t i, bool s_type)
+{
+    if (s_type)
+    {
+        types[i >> 3] |= (unsigned char) (1u << (i & 7));
+    }
+    else
+    {
+        types[i >> 3] &= (unsigned char) ~(1u << (i & 7));
+    }
+}
+
+//! Whether the suffix at `i` is a leftmost S-type one
+static LIBSTRING_INLINE bool __sais_is_lms(const unsigned char * types, size_t i)
+{
+    return i > 0 && i != LIBSTRING_SAIS_EMPTY && __sais_is_s(types, i) && !__sais_is_s(types, i - 1);
+}
+
+//!
+//! \brief __sais_buckets Works out where the bucket of every character starts (or ends, if `end`) in the suffix array.
+//!
+static void __sais_buckets(const void * s, size_t * buckets, size_t n, size_t k, bool wide, bool end)
+{
+    size_t i, sum = 0;
+
+    for (i = 0; i <= k; i++)
+    {
+        buckets[i] = 0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        buckets[__sais_chr(s, i, wide)]++;
+    }
+    for (i = 0; i <= k; i++)
+    {
+        sum += buckets[i];
+        buckets[i] = end ? sum : sum - buckets[i];
+    }
+}
+
+//!
+//! \brief __sais_induce Sorts the L-type suffixes from the ones already placed, then the S-type ones from those.
+//!
+static void __sais_induce(const unsigned char * types, size_t * sa, const void * s, size_t * buckets, size_t n, size_t k, bool wide)
+{
+    size_t i, j;
+
+    __sais_buckets(s, buckets, n, k, wide, false);
+    for (i = 0; i < n; i++)
+    {
+        if (sa[i] != LIBSTRING_SAIS_EMPTY && sa[i] > 0 && !__sais_is_s(types, sa[i] - 1))
+        {
+            j = sa[i] - 1;
+            sa[buckets[__sais_chr(s, j, wide)]++] = j;
+        }
+    }
+
+    __sais_buckets(s, buckets, n, k, wide, true);
+    for (i = n; i-- > 0;)
+    {
+        if (sa[i] != LIBSTRING_SAIS_EMPTY && sa[i] > 0 && __sais_is_s(types, sa[i] - 1))
+        {
+            j = sa[i] - 1;
+            sa[--buckets[__sais_chr(s, j, wide)]] = j;
+        }
+    }
+}
+
+//!
+//! \brief __sais Builds the suffix array of `s`.
+//! \param s      The text, whose last character must be a unique 0.
+//! \param sa     Where to write the n suffixes to.
+//! \param n      The length of `s`, at least 2.
+//! \param k      The biggest character in `s`.
+//! \param wide   Whether `s` is made of size_t's rather than bytes.
+//! \return       False if allocation failed.
+//! The LMS substrings are sorted first, and given names. If some of them are equal, the LMS suffixes are
+//! sorted by recursing over those names. Everything else gets induced from the sorted LMS suffixes.
+//!
+static bool __sais(const void * s, size_t * sa, size_t n, size_t k, bool wide)
+{
+    unsigned char * types = __malloc(n / 8 + 1);
+    size_t * buckets;
+    size_t * s1;
+    size_t i, j, n1 = 0, names = 0, prev = LIBSTRING_SAIS_EMPTY;
+
+    if (!types)
+    {
+        return false;
+    }
+    buckets = __malloc((k + 1) * sizeof(size_t));
+    if (!buckets)
+    {
+        __free(types, n / 8 + 1);
+        return false;
+    }
+
+    __sais_set_type(types, n - 1, true);
+    __sais_set_type(types, n - 2, false);
+    for (i = n - 2; i-- > 0;)
+    {
+        size_t c = __sais_chr(s, i, wide), next = __sais_chr(s, i + 1, wide);
+        __sais_set_type(types, i, c < next || (c == next && __sais_is_s(types, i + 1)));
+    }
+
+    //! Sort the LMS substrings
+    __sais_buckets(s, buckets, n, k, wide, true);
+    for (i = 0; i < n; i++)
+    {
+        sa[i] = LIBSTRING_SAIS_EMPTY;
+    }
+    for (i = 1; i < n; i++)
+    {
+        if (__sais_is_lms(types, i))
+        {
+            sa[--buckets[__sais_chr(s, i, wide)]] = i;
+        }
+    }
+    __sais_induce(types, sa, s, buckets, n, k, wide);
+
+    //! Name them, storing the name of the one at `pos` at n1 + pos / 2 (LMS positions are at least 2 apart)
+    for (i = 0; i < n; i++)
+    {
+        if (__sais_is_lms(types, sa[i]))
+        {
+            sa[n1++] = sa[i];
+        }
+    }
+    for (i = n1; i < n; i++)
+    {
+        sa[i] = LIBSTRING_SAIS_EMPTY;
+    }
+    for (i = 0; i < n1; i++)
+    {
+        size_t pos = sa[i], d;
+        bool differ = false;
+        for (d = 0; d < n; d++)
+        {
+            if (prev == LIBSTRING_SAIS_EMPTY || __sais_chr(s, pos + d, wide) != __sais_chr(s, prev + d, wide)
+                || __sais_is_s(types, pos + d) != __sais_is_s(types, prev + d))
+            {
+                differ = true;
+                break;
+            }
+            if (d > 0 && (__sais_is_lms(types, pos + d) || __sais_is_lms(types, prev + d)))
+            {
+                break;
+            }
+        }
+        if (differ)
+        {
+            names++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = names - 1;
+    }
+    for (i = j = n; i-- > n1;)
+    {
+        if (sa[i] != LIBSTRING_SAIS_EMPTY)
+        {
+            sa[--j] = sa[i];
+        }
+    }
+
+    //! Sort the LMS suffixes, recursing if their names aren't unique yet
+    s1 = sa + n - n1;
+    if (names < n1)
+    {
+        if (!__sais(s1, sa, n1, names - 1, true))
+        {
+            __free(buckets, (k + 1) * sizeof(size_t));
+            __free(types, n / 8 + 1);
+            return false;
+        }
+    }
+    else
+    {
+        for (i = 0; i < n1; i++)
+        {
+            sa[s1[i]] = i;
+        }
+    }
+
+    //! Induce the whole suffix array from the sorted LMS suffixes
+    __sais_buckets(s, buckets, n, k, wide, true);
+    for (i = 1, j = 0; i < n; i++)
+    {
+        if (__sais_is_lms(types, i))
+        {
+            s1[j++] = i;
+        }
+    }
+    for (i = 0; i < n1; i++)
+    {
+        sa[i] = s1[sa[i]];
+    }
+    for (i = n1; i < n; i++)
+    {
+        sa[i] = LIBSTRING_SAIS_EMPTY;
+    }
+    for (i = n1; i-- > 0;)
+    {
+        j = sa[i];
+        sa[i] = LIBSTRING_SAIS_EMPTY;
+        sa[--buckets[__sais_chr(s, j, wide)]] = j;
+    }
+    __sais_induce(types, sa, s, buckets, n, k, wide);
+
+    __free(buckets, (k + 1) * sizeof(size_t));
+    __free(types, n / 8 + 1);
+    return true;
+}
+
+//!
+//! \brief __index_alloc Allocates an index over `size` characters, with room for its suffix array.
+//!
+static string_index_t * __index_alloc(size_t size)
+{
+    string_index_t * index;
+
+    if (size >= ((size_t) -1) / sizeof(size_t) - 1)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_index_build: the text is too big.");
+        return NULL;
+    }
+    index = __malloc(sizeof(string_index_t));
+    if (!index)
+    {
+        return NULL;
+    }
+    index->sa = __malloc((size + 1) * sizeof(size_t));
+    if (!index->sa)
+    {
+        __free(index, sizeof(string_index_t));
+        return NULL;
+    }
+    index->text     = NULL;
+    index->size     = size;
+    index->buffer   = NULL;
+    index->reserved = 0;
+    return index;
+}
+
+//!
+//! \brief string_index_free Frees an index, and drops its reference to the indexed buffer.
+//! \param index             The index, or NULL.
+//!
+void string_index_free(string_index_t * index)
+{
+    if (!index)
+    {
+        return;
+    }
+    if (index->buffer)
+    {
+        __buf_release(index->buffer, index->reserved);
+    }
+    __free(index->sa, (index->size + 1) * sizeof(size_t));
+    __free(index, sizeof(string_index_t));
+}
+
+//!
+//! \brief string_index_build Builds a suffix array over the current value of `str`, in linear time.
+//! \param str                The string to be indexed. Its value may contain NULs.
+//! \return                   The index, to be freed with string_index_free, or NULL on failure.
+//! The index keeps a reference to the buffer of `str` (see string_dup), so it stays valid even if `str` gets
+//! modified or freed. Strings that don't own their buffer must outlive the index.
+//!
+string_index_t * string_index_build(cstr_t * str)
+{
+    string_index_t * index;
+    bool built;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_INDEX_BUILD)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_index_build: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
+
+    index = __index_alloc(str->size);
+    if (!index)
+    {
+        return NULL;
+    }
+
+    if (!str->size)
+    {
+        index->sa[0] = 0;
+        built = true;
+    }
+    else if (!__memchr(str->value, '\0', str->size))
+    {
+        //! The NUL-terminator is already the unique, smallest character SA-IS needs at the end
+        built = __sais(str->value, index->sa, str->size + 1, 255, false);
+    }
+    else
+    {
+        //! Otherwise, shift every character up by one to make room for it
+        size_t i, * shifted = __malloc((str->size + 1) * sizeof(size_t));
+        built = false;
+        if (shifted)
+        {
+            for (i = 0; i < str->size; i++)
+            {
+                shifted[i] = (size_t) (unsigned char) str->value[i] + 1;
+            }
+            shifted[str->size] = 0;
+            built = __sais(shifted, index->sa, str->size + 1, 256, true);
+            __free(shifted, (str->size + 1) * sizeof(size_t));
+        }
     }
-
-    if(__strstr(str1->value, (char *) str2))
+    if (!built)
     {
-        // If __strstr returned a non-NULL pointer, str2 is a substring of str1.
-        return true;
+        __string_error(STRING_ERR_ALLOC, "In string_index_build: the suffix array could not be built.");
+        string_index_free(index);
+        return NULL;
     }
 
-    return  false;
+    index->text = str->value;
+    if (str->flags & STRING_OWNED)
+    {
+        ++*__buf_refs(str->value);
+        index->buffer   = str->value;
+        index->reserved = str->reserved;
+    }
+    return index;
 }
 
-/*!
- * \brief  Initializes a new string, a pointer to cstr_t
- * \param  str       The cstr_t * whose capacity will be altered.
- * \param  capacity  The new memory reserve of the cstr_t *.
- * \retval bool    Returns true if the operation was succesful, false otherwise.
- */
-bool string_reserve(cstr_t *str, size_t capacity)
+//!
+//! \brief __index_bound Finds the first suffix that is not smaller than `pattern` (or, if `after`, that does not
+//!                      start with something smaller than or equal to it).
+//! \return              Its rank in the suffix array.
+//! Every suffix between the two bounds shares at least as many leading characters with the pattern as both bounds
+//! do, so those are skipped when comparing. This makes searches take about O(len + log size) steps.
+//!
+static size_t __index_bound(const string_index_t * index, const char * pattern, size_t len, bool after)
 {
-    if (!sanity_check(str))
+    size_t lo = 0, hi = index->size + 1, lo_lcp = 0, hi_lcp = 0;
+
+    while (lo < hi)
     {
-        fprintf(stderr, "In string_reserve: sanity check on `str` failed.\n");
-        return false;
+        size_t mid = lo + (hi - lo) / 2, pos = index->sa[mid];
+        size_t lcp = lo_lcp < hi_lcp ? lo_lcp : hi_lcp;
+        size_t left = index->size - pos;
+        bool smaller;
+
+        while (lcp < len && lcp < left && index->text[pos + lcp] == pattern[lcp])
+        {
+            lcp++;
+        }
+        if (lcp == len)
+        {
+            smaller = after;
+        }
+        else
+        {
+            smaller = lcp == left || (unsigned char) index->text[pos + lcp] < (unsigned char) pattern[lcp];
+        }
+
+        if (smaller)
+        {
+            lo = mid + 1;
+            lo_lcp = lcp;
+        }
+        else
+        {
+            hi = mid;
+            hi_lcp = lcp;
+        }
     }
+    return lo;
+}
 
-    if (capacity < str->size)
+//!
+//! \brief string_index_count Counts the occurrences of a pattern in the indexed text.
+//! \param index              The index.
+//! \param pattern            The characters to search for. They may contain NULs.
+//! \param len                How many there are. An empty pattern occurs at every position, end included.
+//! \return                   How many times the pattern occurs, overlapping occurrences included.
+//!
+size_t string_index_count(const string_index_t * index, const char * pattern, size_t len)
+{
+    if (!index)
     {
-        //! TODO: Implement truncation?
-        fprintf(stderr, "In string_reserve: new capacity supplied is smaller than the string's current size.\n");
-        return false;
+        __string_error(STRING_ERR_NULL, "In string_index_count: `index` is NULL.");
+        return 0;
     }
+    return __index_bound(index, pattern, len, true) - __index_bound(index, pattern, len, false);
+}
 
-    char * val_backup = __malloc(str->size + 1);
-    str->value        = realloc(str->value, capacity);
-    if(!str->value)
+//!
+//! \brief string_index_contains Verifies if a pattern occurs in the indexed text.
+//! \return                      True if it does.
+//!
+bool string_index_contains(const string_index_t * index, const char * pattern, size_t len)
+{
+    if (!index)
     {
-        //! TODO: needs testing
-        //! I couldn't get realloc to fail in order to test
-        fprintf(stderr, "In string_reserve: reallocation failed with capacity %zu\n", capacity);
-        str->value = val_backup;
+        __string_error(STRING_ERR_NULL, "In string_index_contains: `index` is NULL.");
         return false;
     }
-
-        //! In this case, reallocation worked
-    free (val_backup);      //! Get rid of the backup
-    str->reserved = capacity;
-    return true;
+    return string_index_count(index, pattern, len) > 0;
 }
 
 //!
-//! \brief string_concat_to Concatenates a string str2 to str1.
-//! \param str1 The cstr_t * to where str2 will be concatenated to.
-//! \param str2 The string that will be concatenated to str1.
-//! \return The new size of the resulting cstr_t *.
+//! \brief string_index_locate Finds where a pattern occurs in the indexed text.
+//! \param positions           Where to write the positions to, in no particular order.
+//! \param max                 How many positions fit in `positions`.
+//! \return                    How many times the pattern occurs, which may be more than `max`.
 //!
-size_t string_concat_to(cstr_t * str1, const char * str2)
+size_t string_index_locate(const string_index_t * index, const char * pattern, size_t len, size_t * positions, size_t max)
 {
-    if (!sanity_check(str1))
+    size_t first, last, i;
+
+    if (!index)
     {
-        fprintf(stderr, "In string_concat_to: sanity check on `str1` failed.\n");
+        __string_error(STRING_ERR_NULL, "In string_index_locate: `index` is NULL.");
         return 0;
     }
+    first = __index_bound(index, pattern, len, false);
+    last  = __index_bound(index, pattern, len, true);
+    for (i = 0; i < max && first + i < last; i++)
+    {
+        positions[i] = index->sa[first + i];
+    }
+    return last - first;
+}
 
-    size_t str2len = __strlen(str2);
-
-    if(!str2len) {
-        return 0;
+static void __put_u64(char * dest, size_t value)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        dest[i] = (char) (value & 0xFF);
+        value >>= 8;
     }
+}
 
-    if(str1->reserved < str1->size + str2len + 1)
+static bool __get_u64(const char * src, size_t * value)
+{
+    int i;
+    *value = 0;
+    for (i = 7; i >= 0; i--)
     {
-        if(!string_reserve(str1, str1->size + str2len + 1))
+        if (*value > ((size_t) -1) >> 8)
         {
-            fprintf(stderr, "In string_concat_to: string_reserve failed.\n");
-            return 0;
+            return false;
         }
+        *value = (*value << 8) | (unsigned char) src[i];
     }
-
-    str1->size += str2len;
-    __strncat(str1->value, str2, str1->size);
-    return str2len;
+    return true;
 }
 
 //!
-//! \brief string_concat Concatenates str2 to str1 and returns that value into a new cstr_t *.
-//! \param str1          The value to where str2 will be concatenated to. The function does not alter str1.
-//! \param str2          The string that will be concatenated to str1.
-//! \return              A new value containing str1 + str2
+//! \brief string_index_serialize Writes an index (indexed text included) to a new string, e.g. to be saved to a file.
+//! \param index                  The index.
+//! \return                       A new cstr_t * holding the serialized index, or NULL on failure.
+//! The format is portable: the magic "LSIX", a version byte, the text size as a 64-bit little-endian number,
+//! the text, and every suffix array entry as a 64-bit little-endian number.
 //!
-cstr_t * string_concat(cstr_t * str1, const char * str2)
+cstr_t * string_index_serialize(const string_index_t * index)
 {
-    if (!sanity_check(str1))
+    cstr_t * out;
+    char * dest;
+    size_t i, bytes;
+
+    if (!index)
     {
-        fprintf(stderr, "In string_concat: sanity check on `str1` failed.\n");
-        return 0;
+        __string_error(STRING_ERR_NULL, "In string_index_serialize: `index` is NULL.");
+        return NULL;
     }
-    cstr_t * new = string_init(str1->value);
 
-    size_t str2len = __strlen(str2);
-    if(new->reserved < str1->size + str2len + 1)
+    if (index->size >= ((size_t) -1 - 32) / 9)
     {
-        if(!string_reserve(new, new->size + str2len + 1))
-        {
-            fprintf(stderr, "In string_concat: string_reserve failed.\n");
-            return new;
-        }
+        __string_error(STRING_ERR_RANGE, "In string_index_serialize: the index is too big.");
+        return NULL;
     }
-    new->size = str1->size + str2len;
-    __strncat(new->value, str2, new->size);
-    return new;
+    bytes = 4 + 1 + 8 + index->size + (index->size + 1) * 8;
+    out = string_alloc(bytes + 1);
+    if (!out)
+    {
+        return NULL;
+    }
+
+    dest = __memcpy(out->value, LIBSTRING_INDEX_MAGIC, 4);
+    *dest++ = LIBSTRING_INDEX_VERSION;
+    __put_u64(dest, index->size);
+    dest = __memcpy(dest + 8, index->text, index->size);
+    for (i = 0; i <= index->size; i++, dest += 8)
+    {
+        __put_u64(dest, index->sa[i]);
+    }
+    *dest = '\0';
+    out->size = bytes;
+    return out;
 }
 
 //!
-//! \brief string_replace_char Replaces all instances of `before` in str to `after`.
-//! \param str                 The cstr_t * to be altered.
-//! \param before              The char to be replaced by `after`.
-//! \param after               The char to replace `before`.
-//! \return                    The quantity of changed characters.
-//!
-//! TODO: make string_replace_char_to
+//! \brief string_index_load Reads back an index written by string_index_serialize.
+//! \param data              The serialized index.
+//! \param size              Its size in bytes.
+//! \return                  The index, to be freed with string_index_free, or NULL if `data` is not a valid index.
+//! Nothing gets sorted again, so this is about as fast as copying `data`.
 //!
-size_t string_replace_char(cstr_t *str, char before, char after)
+string_index_t * string_index_load(const char * data, size_t size)
 {
-    if(!sanity_check(str))
+    string_index_t * index;
+    size_t text_size, i;
+    const char * src;
+
+    if (!data)
     {
-        fprintf(stderr, "In string_replace_char: sanity  check on `str` failed.\n");
-        return 0;
+        __string_error(STRING_ERR_NULL, "In string_index_load: `data` is NULL.");
+        return NULL;
+    }
+    if (size < 13 || !__memeq((char *) data, LIBSTRING_INDEX_MAGIC, 4) || data[4] != LIBSTRING_INDEX_VERSION
+        || !__get_u64(data + 5, &text_size) || text_size >= ((size_t) -1 - 32) / 9
+        || size != 13 + text_size + (text_size + 1) * 8)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_index_load: `data` is not a serialized index.");
+        return NULL;
     }
 
-    size_t i, modified = 0;
+    index = __index_alloc(text_size);
+    if (!index)
+    {
+        return NULL;
+    }
+    index->buffer = __buf_alloc(text_size);
+    if (!index->buffer)
+    {
+        string_index_free(index);
+        return NULL;
+    }
+    index->reserved = text_size;
+    __memcpy(index->buffer, data + 13, text_size);
+    index->buffer[text_size] = '\0';
+    index->text = index->buffer;
 
-    for(i=0; i < str->size; i++)
+    src = data + 13 + text_size;
+    for (i = 0; i <= text_size; i++, src += 8)
     {
-        if(str->value[i] == before)
+        //! Positions are only checked to be in range, so a corrupted index can give wrong answers but never crash
+        if (!__get_u64(src, &index->sa[i]) || index->sa[i] > text_size)
         {
-            str->value[i] = after;
-            modified++;
+            __string_error(STRING_ERR_RANGE, "In string_index_load: `data` is not a serialized index.");
+            string_index_free(index);
+            return NULL;
         }
     }
-    return modified;
+    return index;
 }
 
+//! **** Hex, base64 and JSON escaping **** !//
+//! Each of these computes the exact size of its output first and writes it straight into a single new string.
+//! Hex encoding and the search for chars to escape in JSON go a word at a time. Without byte shuffles, moving
+//! bytes around within words costs more than it saves for base64 and for decoding, which use lookup tables.
+
+#define LIBSTRING_BASE64_ALPHABET "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+
+//! LIBSTRING_LANES(bits) has a 1 in the lowest bit of every `bits`-wide lane of a word, as LIBSTRING_ONES does for bytes
+#define LIBSTRING_LANES(bits) ((size_t) -1 / ((((size_t) 1 << ((bits) / 2)) << ((bits) / 2)) - 1))
+
+//! The value of every hex digit and base64 character, 0xFF for any other char.
+static const unsigned char hex_values[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const unsigned char base64_values[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
 
 //!
-//! \brief string_swap Swaps the content of str1 with str2.
-//! \param str1        An initialized cstr_t *.
-//! \param str2        An initialized cstr_t *.
-//! \return A success-run boolean.
+//! \brief __swar_spread_bytes Moves the bytes of the low half of a word to every other byte of it.
+//! \param half                A word whose high half is zero.
+//! \return                    The word with byte `i` moved to byte `2 * i`, and zeroes in between.
 //!
-bool string_swap(cstr_t * str1, cstr_t * str2)
+static LIBSTRING_INLINE size_t __swar_spread_bytes(size_t half)
 {
-    if (!sanity_check(str1))
+    size_t bits;
+
+    //! On 64 bits: 0x00000000AABBCCDD -> 0x0000AABB0000CCDD -> 0x00AA00BB00CC00DD
+    for (bits = LIBSTRING_WORD_SIZE * 2; bits >= 8; bits /= 2)
     {
-        fprintf(stderr, "In string_swap: sanity check on `str1` failed.\n");
-        return false;
+        half = (half | half << bits) & (LIBSTRING_LANES(bits * 2) * (((size_t) 1 << bits) - 1));
     }
-    if (!sanity_check(str2))
+    return half;
+}
+
+//!
+//! \brief __hex_encode_half Hex-encodes the bytes in the low half of a word, without leaving the registers.
+//! \return                  A word of lower-case hex digits, ready to be stored (on little-endian machines).
+//! Each byte is spread out into two bytes holding a nibble each, and all of those are turned into digits at once.
+//!
+static LIBSTRING_INLINE size_t __hex_encode_half(size_t half)
+{
+    size_t spread = __swar_spread_bytes(half);
+    size_t nibbles = (spread >> 4 & LIBSTRING_ONES * 0x0F) | (spread & LIBSTRING_ONES * 0x0F) << 8;
+    size_t above_9 = ((nibbles + LIBSTRING_ONES * 0x76) & LIBSTRING_HIGHS) >> 7;
+    return nibbles + LIBSTRING_ONES * '0' + above_9 * ('a' - '0' - 10);
+}
+
+//!
+//! \brief string_hex_encode Encodes `str` as lower-case hex, two digits per byte.
+//! \param str               The string to be encoded.
+//! \return                  A new cstr_t * with the encoded string, or NULL on failure.
+//!
+cstr_t * string_hex_encode(cstr_t * str)
+{
+    cstr_t * out;
+    const char * src;
+    char * dest;
+    size_t n, word;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_ENCODE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_hex_encode: sanity check on `str` failed."))
     {
-        fprintf(stderr, "In string_swap: sanity check on `str2` failed.\n");
-        return false;
+        return NULL;
+    }
+    if (str->size >= ((size_t) -1) / 2)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_hex_encode: the encoded string would be too long.");
+        return NULL;
     }
 
-    size_t str1_val_size   = str1->size;
-    char * str1_val_backup = malloc(str1_val_size + 1);
-    if(!str1_val_backup)
+    out = string_alloc(str->size * 2 + 1);
+    if (!out)
     {
-        fprintf(stderr, "In string_swap: malloc failed.\n");
-        return false;
+        return NULL;
     }
 
-    __strcpy(str1_val_backup, str1->value, str1_val_size);
-    size_t str1_res_backup = str1->reserved;
-    free(str1->value);
-    str1->value    = str2->value;
-    str1->size     = str2->size;
-    str1->reserved = str2->reserved;
+    src = str->value;
+    dest = out->value;
+    for (n = str->size; __swar_little_endian() && n >= LIBSTRING_WORD_SIZE; n -= LIBSTRING_WORD_SIZE, src += LIBSTRING_WORD_SIZE)
+    {
+        word = __load_word(src);
+        __store_word(dest, __hex_encode_half(word & ((size_t) -1 >> (LIBSTRING_WORD_SIZE * 4))));
+        __store_word(dest + LIBSTRING_WORD_SIZE, __hex_encode_half(word >> (LIBSTRING_WORD_SIZE * 4)));
+        dest += LIBSTRING_WORD_SIZE * 2;
+    }
+    for (; n; n--, src++)
+    {
+        *dest++ = "0123456789abcdef"[(unsigned char) *src >> 4];
+        *dest++ = "0123456789abcdef"[*src & 0x0F];
+    }
+    *dest = '\0';
+    return out;
+}
 
-    str2->value    = str1_val_backup;
-    str2->size     = str1_val_size;
-    str2->reserved = str1_res_backup;
+//!
+//! \brief string_hex_decode Decodes a string of hex digits (of either case) back into bytes.
+//! \param str               The string to be decoded.
+//! \return                  A new cstr_t * with the decoded bytes, or NULL on failure (STRING_ERR_RANGE if `str` is not valid hex).
+//!
+cstr_t * string_hex_decode(cstr_t * str)
+{
+    cstr_t * out;
+    const unsigned char * src;
+    char * dest;
+    size_t n;
+    unsigned invalid;
 
-    return true;
+    LIBSTRING_STATS_SCOPE(STRING_STAT_ENCODE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_hex_decode: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
+    if (str->size % 2)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_hex_decode: `str` has an odd number of digits.");
+        return NULL;
+    }
+
+    out = string_alloc(str->size / 2 + 1);
+    if (!out)
+    {
+        return NULL;
+    }
+
+    //! The values of invalid digits have their high bit set, which ends up in `invalid`
+    src = (const unsigned char *) str->value;
+    dest = out->value;
+    for (invalid = 0, n = str->size; n; n -= 2, src += 2)
+    {
+        invalid |= hex_values[src[0]] | hex_values[src[1]];
+        *dest++ = (char) (hex_values[src[0]] << 4 | hex_values[src[1]]);
+    }
+    if (invalid & 0x80)
+    {
+        string_free(out);
+        __string_error(STRING_ERR_RANGE, "In string_hex_decode: `str` is not valid hex.");
+        return NULL;
+    }
+    *dest = '\0';
+    return out;
 }
 
 //!
-//! \brief string_mid Returns a substring of a given string starting at position pos with a given length.
-//! \param str Source string for the substring.
-//! \param pos Position of the starting character.
-//! \param length Desired length of the substring. -1 for everything after pos.
-//! \return Generated substring.
+//! \brief string_base64_encode Encodes `str` as base64 (RFC 4648, with padding).
+//! \param str                  The string to be encoded.
+//! \return                     A new cstr_t * with the encoded string, or NULL on failure.
 //!
-cstr_t * string_mid(cstr_t *str, size_t pos, long length)
+cstr_t * string_base64_encode(cstr_t * str)
 {
-    if (!sanity_check(str))
+    cstr_t * out;
+    const unsigned char * src;
+    char * dest;
+    size_t n;
+    unsigned long group;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_ENCODE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_base64_encode: sanity check on `str` failed."))
     {
-        fprintf(stderr, "In string_mid: sanity check on `str` failed.\n");
-        return 0;
+        return NULL;
+    }
+    if (str->size / 3 >= ((size_t) -1) / 4 - 1)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_base64_encode: the encoded string would be too long.");
+        return NULL;
     }
 
-    if (str->size <= pos || str->size == 0 || (length < 1 && length != -1))
+    out = string_alloc((str->size + 2) / 3 * 4 + 1);
+    if (!out)
     {
-        return string_init("");
+        return NULL;
     }
 
-    size_t stop_element;
+    src = (const unsigned char *) str->value;
+    dest = out->value;
+    for (n = str->size; n >= 3; n -= 3, src += 3)
+    {
+        group = (unsigned long) src[0] << 16 | (unsigned long) src[1] << 8 | src[2];
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group >> 18];
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group >> 12 & 0x3F];
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group >> 6 & 0x3F];
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group & 0x3F];
+    }
+    if (n)
+    {
+        group = (unsigned long) src[0] << 16 | (n == 2 ? (unsigned long) src[1] << 8 : 0);
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group >> 18];
+        *dest++ = LIBSTRING_BASE64_ALPHABET[group >> 12 & 0x3F];
+        *dest++ = n == 2 ? LIBSTRING_BASE64_ALPHABET[group >> 6 & 0x3F] : '=';
+        *dest++ = '=';
+    }
+    *dest = '\0';
+    return out;
+}
 
-    if (length == -1)
-        stop_element = str->size;
-    else
-        stop_element = __cstr_min(str->size, pos + (size_t) length);
+//!
+//! \brief string_base64_decode Decodes a base64 string (RFC 4648) back into bytes.
+//! \param str                  The string to be decoded. Its padding may be left out.
+//! \return                     A new cstr_t * with the decoded bytes, or NULL on failure (STRING_ERR_RANGE if `str` is not valid base64).
+//!
+cstr_t * string_base64_decode(cstr_t * str)
+{
+    cstr_t * out;
+    const unsigned char * src;
+    char * dest;
+    size_t n, i;
+    unsigned long group, invalid;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_ENCODE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_base64_decode: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
 
-    cstr_t *result = string_init("\0");
-    string_reserve(result, stop_element - pos + 1);
+    //! Up to two '=' may pad the string to a multiple of 4 characters
+    n = str->size;
+    if (n && n % 4 == 0 && str->value[n - 1] == '=')
+    {
+        n -= str->value[n - 2] == '=' ? 2 : 1;
+    }
+    if (n % 4 == 1)
+    {
+        __string_error(STRING_ERR_RANGE, "In string_base64_decode: `str` is not valid base64.");
+        return NULL;
+    }
 
-    __strcpy(result->value, &str->value[pos], stop_element - pos);
+    out = string_alloc(n / 4 * 3 + (n % 4 ? n % 4 - 1 : 0) + 1);
+    if (!out)
+    {
+        return NULL;
+    }
 
-    return result;
+    //! The values of invalid characters have their high bit set, which ends up in `invalid`
+    src = (const unsigned char *) str->value;
+    dest = out->value;
+    for (invalid = 0; n >= 4; n -= 4, src += 4)
+    {
+        invalid |= base64_values[src[0]] | base64_values[src[1]] | base64_values[src[2]] | base64_values[src[3]];
+        group = (unsigned long) base64_values[src[0]] << 18 | (unsigned long) base64_values[src[1]] << 12
+              | (unsigned long) base64_values[src[2]] << 6 | base64_values[src[3]];
+        *dest++ = (char) (group >> 16);
+        *dest++ = (char) (group >> 8);
+        *dest++ = (char) group;
+    }
+    if (n)
+    {
+        for (group = 0, i = 0; i < n; i++)
+        {
+            invalid |= base64_values[src[i]];
+            group |= (unsigned long) base64_values[src[i]] << (18 - 6 * i);
+        }
+        *dest++ = (char) (group >> 16);
+        if (n == 3)
+        {
+            *dest++ = (char) (group >> 8);
+        }
+    }
+    if (invalid & 0x80)
+    {
+        string_free(out);
+        __string_error(STRING_ERR_RANGE, "In string_base64_decode: `str` is not valid base64.");
+        return NULL;
+    }
+    *dest = '\0';
+    return out;
 }
 
 //!
-//! \brief string_left Returns the first (length) characters of a string starting from the left.
-//! \param str Source string for the substring.
-//! \param length Amount of characters desired.
-//! \return Generated substring.
+//! \brief __json_special Finds the first char of a char array that has to be escaped in a JSON string.
+//! \param str            The char array to be searched.
+//! \param n              Its size.
+//! \return               The position of that char, or `n` if there is none.
+//! These are '"', '\\' and the control characters below 0x20. Anything else, UTF-8 included, is kept as is.
 //!
-LIBSTRING_INLINE cstr_t * string_left(cstr_t *str, long length)
+static size_t __json_special(const char * str, size_t n)
 {
-    return string_mid(str, 0, (long) length);
+    size_t i, word, marks;
+
+    for (i = 0; i + LIBSTRING_WORD_SIZE <= n; i += LIBSTRING_WORD_SIZE)
+    {
+        word = __load_word(str + i);
+        marks = __swar_zero_bytes(word & LIBSTRING_ONES * 0xE0)
+              | __swar_zero_bytes(word ^ LIBSTRING_ONES * '"')
+              | __swar_zero_bytes(word ^ LIBSTRING_ONES * '\\');
+        if (marks)
+        {
+            return i + __swar_first_marked(marks);
+        }
+    }
+    for (; i < n; i++)
+    {
+        if ((unsigned char) str[i] < 0x20 || str[i] == '"' || str[i] == '\\')
+        {
+            break;
+        }
+    }
+    return i;
 }
 
 //!
-//! \brief string_left Returns the first (length) characters of a string starting from the right.
-//! \param str Source string for the substring.
-//! \param length Amount of characters desired.
-//! \return Generated substring.
+//! \brief __json_escape_char Gives the escape sequence of a char found by __json_special.
+//! \param c                  The char.
+//! \param dest               Where the escape sequence is written to, if not NULL.
+//! \return                   Its length: 2 for the short ones (e.g. "\n"), 6 for the "\u00XX" ones.
 //!
-cstr_t * string_right(cstr_t *str, long length)
+static size_t __json_escape_char(char c, char * dest)
 {
-    size_t start_pos;
-    if ((unsigned) length >= str->size)
+    char short_form;
+
+    switch (c)
     {
-        start_pos = 0;
+        case '"':  short_form = '"';  break;
+        case '\\': short_form = '\\'; break;
+        case '\b': short_form = 'b';  break;
+        case '\f': short_form = 'f';  break;
+        case '\n': short_form = 'n';  break;
+        case '\r': short_form = 'r';  break;
+        case '\t': short_form = 't';  break;
+        default:   short_form = 0;    break;
     }
-    else
+
+    if (short_form)
     {
-        start_pos = str->size - length;
+        if (dest)
+        {
+            dest[0] = '\\';
+            dest[1] = short_form;
+        }
+        return 2;
+    }
+    if (dest)
+    {
+        __memcpy(dest, "\\u00", 4);
+        dest[4] = "0123456789abcdef"[(unsigned char) c >> 4];
+        dest[5] = "0123456789abcdef"[c & 0x0F];
     }
+    return 6;
+}
 
-    return string_mid(str, start_pos, -1);
+//!
+//! \brief string_json_escape Escapes `str` so that it can be put between quotes in a JSON document.
+//! \param str                The string to be escaped.
+//! \return                   A new cstr_t * with the escaped string (sharing the buffer of `str` if nothing had to be escaped), or NULL on failure.
+//! Only '"', '\\' and the control characters are escaped, so the result is valid JSON as long as `str` is valid UTF-8.
+//!
+cstr_t * string_json_escape(cstr_t * str)
+{
+    cstr_t * out;
+    char * dest;
+    size_t pos, next, total;
+
+    LIBSTRING_STATS_SCOPE(STRING_STAT_ENCODE)
+    if (!LIBSTRING_SANITY_CHECK(str, "In string_json_escape: sanity check on `str` failed."))
+    {
+        return NULL;
+    }
+
+    //! The first pass only sizes the result, skipping a word at a time over what needs no escaping
+    total = str->size;
+    for (pos = __json_special(str->value, str->size); pos < str->size; pos += 1 + __json_special(str->value + pos + 1, str->size - pos - 1))
+    {
+        if (total >= (size_t) -1 - 6)
+        {
+            __string_error(STRING_ERR_RANGE, "In string_json_escape: the escaped string would be too long.");
+            return NULL;
+        }
+        total += __json_escape_char(str->value[pos], NULL) - 1;
+    }
+    if (total == str->size)
+    {
+        return string_dup(str);    //! Same value, so no need for a copy
+    }
+
+    out = string_alloc(total + 1);
+    if (!out)
+    {
+        return NULL;
+    }
+
+    dest = out->value;
+    for (pos = 0; pos < str->size; pos = next + 1)
+    {
+        next = pos + __json_special(str->value + pos, str->size - pos);
+        dest = __memcpy(dest, str->value + pos, next - pos);
+        if (next == str->size)
+        {
+            break;
+        }
+        dest += __json_escape_char(str->value[next], dest);
+    }
+    *dest = '\0';
+    return out;
 }
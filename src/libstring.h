@@ -32,32 +32,63 @@
 
 #include <stdlib.h>
 
-#ifdef __STDC_VERSION__
+#if defined(__cplusplus)
+    /* bool is built in */
+#elif defined(__STDC_VERSION__)
 #   include <stdbool.h>
 #else
     typedef enum { false, true,} bool;
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Set on strings whose buffer is reference-counted and owned by libstring, i.e. every
+// string it creates. Copies (see string_dup) share that buffer until one of them is
+// modified. Strings without this flag are never written to by libstring.
+#define STRING_OWNED 0x1
+
 struct cstr
 {
     char * value;
     size_t size;
     size_t reserved;
+    unsigned flags;
 };
 
 typedef struct cstr cstr_t;
 
+// A read-only run of characters, not necessarily NUL-terminated.
+struct cstr_view
+{
+    const char * value;
+    size_t size;
+};
+
+typedef struct cstr_view cstr_view_t;
+
+// Returned by the functions that give a position when there is nothing to be found.
+#define STRING_NPOS ((size_t) -1)
+
+// String literals that are neither allocated nor registered, and whose length is known at
+// compile time. They don't own their buffer, so libstring never writes to nor frees them.
+//     static cstr_t greeting = STRING_LIT_INIT("Hello");   (any C version)
+//     string_contains_view(str, STRING_VIEW_LIT("needle"))  (C99 and newer)
+//     cstr_t * copy = string_dup(STRING_LIT("Hello"));      (C99 and newer)
+#define STRING_LIT_INIT(lit) { (char *) ("" lit), sizeof(lit) - 1, sizeof(lit) - 1, 0 }
+#define STRING_VIEW_LIT_INIT(lit) { "" lit, sizeof(lit) - 1 }
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L && !defined(__cplusplus)
+#   define STRING_LIT(lit)      (&(cstr_t) STRING_LIT_INIT(lit))
+#   define STRING_VIEW_LIT(lit) ((cstr_view_t) STRING_VIEW_LIT_INIT(lit))
+#endif
+
 // TODO:
 //bool string_resize(cstr_t *str, size_t new_size);
-//bool string_free(cstr_t * str);
-//bool string_ends_with_x(cstr_t * str, cstr_t * x);
 //char string_get_char_at(cstr_t * str, size_t pos);
-//size_t string_index_of(cstr_t *str, char c);
-//size_t string_last_index_of(cstr_t *str, char c);
 // int string_to_int(cstr_t * str);
 // bool string_set_char_at(cstr_t * str, size_t pos);
 // size_t string_size(cstr_t * str);
-// bool string_starts_with_x(cstr_t * str, cstr_t * x);
 // cstr_t * string_reverse(cstr_t * str);
 // cstr_t * string_reverse_to(cstr_t * str, cstr_t * dest);
 // bool string_is_equal(cstr_t * str1, const char str2);
@@ -65,8 +96,15 @@ typedef struct cstr cstr_t;
     /***  Function prototypes ***/
 // Initialization and memory
 cstr_t * string_init(const char * origin);
+cstr_t * string_init_n(const char * origin, size_t len);
+/* Returns a copy of `str` that shares its buffer until either of them gets modified. */
+cstr_t * string_dup(cstr_t * str);
+/* Returns a view of the current value of `str`. */
+cstr_view_t string_view(const cstr_t * str);
 /* Attempts to reserve `capacity` bytes onto the string, returns true if possible. */
 bool string_reserve(cstr_t *str, size_t capacity);
+/* Frees a single string. Its buffer is only freed once no copy shares it. */
+void string_free(cstr_t * str);
 /* Frees all allocated strings */
 void string_free_all(void);
 
@@ -75,22 +113,195 @@ void string_free_all(void);
 int string_compare(cstr_t * str1, cstr_t * str2);
 cstr_t * string_concat(cstr_t * str1, const char * str2);
 size_t string_concat_to(cstr_t * str1, const char * str2);
+size_t string_concat_to_n(cstr_t * str1, const char * str2, size_t len);
+size_t string_concat_to_view(cstr_t * str1, cstr_view_t str2);
 cstr_t * string_left(cstr_t * str, long length);
 cstr_t * string_mid(cstr_t * str, size_t pos, long length);
-void string_replace(cstr_t *str, char * old_val, const char * new_val); // TODO: add a return value
+void string_replace(cstr_t *str, char * old_val, const char * new_val);
+/* Like string_replace, with known lengths. Returns the number of replacements. */
+size_t string_replace_n(cstr_t * str, const char * old_val, size_t old_len, const char * new_val, size_t new_len);
+size_t string_replace_view(cstr_t * str, cstr_view_t old_val, cstr_view_t new_val);
 size_t string_replace_char(cstr_t *str, char before, char after);
 cstr_t * string_right(cstr_t * str, long length);
 bool string_swap(cstr_t * str1, cstr_t * str2);
 
 cstr_t * string_to_lower_case(cstr_t * origin);
 cstr_t * string_to_upper_case(cstr_t * origin);
+cstr_t * string_fold_case(cstr_t * origin);
 bool string_contains(cstr_t * str1, const char * str2);
+bool string_contains_n(cstr_t * str1, const char * str2, size_t len);
+bool string_contains_view(cstr_t * str1, cstr_view_t str2);
+/* Char searches. The index ones return STRING_NPOS when `c` isn't found. */
+size_t string_index_of(cstr_t * str, char c);
+size_t string_last_index_of(cstr_t * str, char c);
+size_t string_count_char(cstr_t * str, char c);
+bool string_starts_with_x(cstr_t * str, cstr_t * x);
+bool string_ends_with_x(cstr_t * str, cstr_t * x);
 size_t string_update(cstr_t * str, const char * new_val);
+/* Case-insensitive (Unicode simple case folding) searches, which allocate nothing. */
+bool string_contains_nocase(cstr_t * str1, const char * str2);
+bool string_contains_nocase_n(cstr_t * str1, const char * str2, size_t len);
+size_t string_find_nocase(cstr_t * str, const char * needle);
+size_t string_find_nocase_n(cstr_t * str, const char * needle, size_t len);
 
 
+// Splitting and joining
+/* Splits `str` at every `delim`. Returns `*count` views into its (shared) buffer, to be freed with string_split_free. */
+cstr_view_t * string_split(cstr_t * str, const char * delim, size_t * count);
+cstr_view_t * string_split_n(cstr_t * str, const char * delim, size_t delim_len, size_t * count);
+cstr_view_t * string_split_view(cstr_t * str, cstr_view_t delim, size_t * count);
+void string_split_free(cstr_view_t * parts);
+/* Joins `count` pieces with `sep` between them, allocating the result once. */
+cstr_t * string_join(const cstr_view_t * parts, size_t count, const char * sep);
+cstr_t * string_join_n(const cstr_view_t * parts, size_t count, const char * sep, size_t sep_len);
+
+// Regular expressions and globs
+// Compiled patterns are matched by a DFA built lazily, so matching takes linear time. The DFA is
+// cached in the pattern itself, which is thus not to be shared between threads.
+typedef struct string_regex string_regex_t;
+/* Compiles an expression with `.`, `[...]`, `\d\w\s`, groups, `|`, `* + ? {m,n}`, and `^`/`$` around the whole of it. */
+string_regex_t * string_regex_compile(const char * pattern);
+/* Compiles a glob (`*`, `?`, `[...]`, `[!...]`), which has to match the whole string. */
+string_regex_t * string_glob_compile(const char * pattern);
+bool string_regex_match(string_regex_t * re, cstr_t * str);
+bool string_regex_match_view(string_regex_t * re, cstr_view_t str);
+void string_regex_free(string_regex_t * re);
+
+// Full-text index
+// A suffix array over a string, built once in linear time, which then finds any pattern in about
+// O(pattern length + log(text length)) steps, wherever it occurs.
+typedef struct string_index string_index_t;
+string_index_t * string_index_build(cstr_t * str);
+void string_index_free(string_index_t * index);
+bool string_index_contains(const string_index_t * index, const char * pattern, size_t len);
+size_t string_index_count(const string_index_t * index, const char * pattern, size_t len);
+/* Writes up to `max` of the positions the pattern occurs at. Returns how many there are. */
+size_t string_index_locate(const string_index_t * index, const char * pattern, size_t len, size_t * positions, size_t max);
+/* Serializes the index (and the text it indexes), e.g. to be saved to disk, and reads it back. */
+cstr_t * string_index_serialize(const string_index_t * index);
+string_index_t * string_index_load(const char * data, size_t size);
+
+// Encodings
+// Each result is sized exactly and allocated once. Decoding invalid input fails with STRING_ERR_RANGE.
+cstr_t * string_hex_encode(cstr_t * str);
+cstr_t * string_hex_decode(cstr_t * str);
+cstr_t * string_base64_encode(cstr_t * str);
+/* The padding of `str` may be left out. */
+cstr_t * string_base64_decode(cstr_t * str);
+/* Escapes '"', '\\' and control characters, e.g. to write `str` between quotes in a JSON document. */
+cstr_t * string_json_escape(cstr_t * str);
+
 char * string_first_token(char * str, char * delim);
 char * string_get_token(char * delim);
 
+
+    /***  Allocators ***/
+// By default, libstring allocates with malloc, realloc and free. Every allocation
+// can instead be routed through a set of hooks, which also get the size of the
+// block being resized or freed.
+
+struct string_allocator
+{
+    void * (* allocate)  (void * context, size_t size);
+    // Must leave `ptr` untouched and return NULL on failure.
+    void * (* reallocate)(void * context, void * ptr, size_t old_size, size_t new_size);
+    void   (* deallocate)(void * context, void * ptr, size_t size);
+    void   * context;
+};
+
+typedef struct string_allocator string_allocator_t;
+typedef struct string_pool string_pool_t;
+
+/* Makes libstring allocate through `hooks` (NULL for malloc/realloc/free).
+   Fails while any string, split array, regex or index made by libstring is still allocated. */
+bool string_set_allocator(const string_allocator_t * hooks);
+/* Creates a size-class pool allocator tuned for short strings (blocks of 16 bytes up to 2 KiB). */
+string_pool_t * string_pool_create(void);
+/* Frees the pool and every block it handed out. */
+void string_pool_destroy(string_pool_t * pool);
+/* Returns the hooks that allocate from `pool`, to be given to string_set_allocator. */
+string_allocator_t string_pool_allocator(string_pool_t * pool);
+
+
+    /***  Error handling ***/
+// Errors used to be printed to stderr. They are now stored as a per-thread error
+// code and handed to an error handler, which prints them to stderr by default.
+// Defining LIBSTRING_RELEASE when building libstring.c turns every sanity check
+// into an assert() and makes the default handler do nothing, so stdio is not used.
+
+enum string_error
+{
+    STRING_OK = 0,
+    STRING_ERR_NULL,            // A NULL string was given
+    STRING_ERR_UNINITIALIZED,   // The given string is probably not initialized
+    STRING_ERR_ALLOC,           // A memory allocation failed
+    STRING_ERR_RANGE,           // An argument was out of range
+    STRING_ERR_READONLY         // The string does not own its buffer, so it can't be modified
+};
+
+typedef void (* string_error_handler_t)(enum string_error error, const char * message, void * context);
+
+/* Returns the last error reported on the calling thread (STRING_OK if there was none). */
+enum string_error string_last_error(void);
+/* Resets the calling thread's last error to STRING_OK. */
+void string_clear_error(void);
+/* Installs `handler` to be called on every error. NULL restores the default handler. */
+void string_set_error_handler(string_error_handler_t handler, void * context);
+/* Returns a static description of `error`. */
+const char * string_error_description(enum string_error error);
+
+
+    /***  Statistics ***/
+// Only collected when libstring.c is built with -DLIBSTRING_STATS. Otherwise none
+// of the counters exist and string_stats_snapshot() just returns false.
+
+enum string_stat_fn
+{
+    STRING_STAT_INIT,
+    STRING_STAT_DUP,
+    STRING_STAT_RESERVE,
+    STRING_STAT_UPDATE,
+    STRING_STAT_CONCAT,
+    STRING_STAT_CONCAT_TO,
+    STRING_STAT_CONTAINS,
+    STRING_STAT_REPLACE,
+    STRING_STAT_REPLACE_CHAR,
+    STRING_STAT_TO_LOWER_CASE,
+    STRING_STAT_TO_UPPER_CASE,
+    STRING_STAT_FOLD_CASE,
+    STRING_STAT_SWAP,
+    STRING_STAT_MID,
+    STRING_STAT_SPLIT,
+    STRING_STAT_JOIN,
+    STRING_STAT_REGEX_MATCH,
+    STRING_STAT_INDEX_BUILD,
+    STRING_STAT_FIND_NOCASE,
+    STRING_STAT_INDEX_OF,
+    STRING_STAT_ENCODE,
+    STRING_STAT_FN_COUNT
+};
+
+#define STRING_STATS_BUCKETS 32
+
+struct string_stats
+{
+    size_t live_strings;            // Strings currently in the allocation list
+    size_t bytes_reserved;          // Sum of `reserved` over the live strings (shared buffers count once per string)
+    size_t bytes_used;              // Sum of `size` over the live strings
+    size_t peak_bytes_reserved;     // Highest bytes_reserved seen since the last reset
+    size_t reallocs;                // Times string_reserve had to reallocate
+    size_t calls[STRING_STAT_FN_COUNT];
+    // cycles[fn][i] counts the calls to fn that took between 2^i and 2^(i+1) - 1 cycles
+    size_t cycles[STRING_STAT_FN_COUNT][STRING_STATS_BUCKETS];
+};
+
+typedef struct string_stats string_stats_t;
+
+/* Copies the current statistics to `out`. Returns false if statistics were not compiled in. */
+bool string_stats_snapshot(string_stats_t * out);
+/* Zeroes the counters and histograms, and sets the peak to the current reservation. */
+void string_stats_reset(void);
+
 /* Implement if possible (not a priority atm) */
 //cstr_t string_tokenize(cstr_t * str, char delim);
 //stol   - Convert string to long int
@@ -100,4 +311,8 @@ char * string_get_token(char * delim);
 //stof   - Convert string to float
 //stod   - Convert string to double (function template )
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
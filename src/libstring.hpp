@@ -0,0 +1,269 @@
+/*
+ * libstring
+ * https://github.com/carmesim/libstring
+ *
+ * Copyright (c) 2020 Vinícius R. Miguel, Ivan dos Santos Muniz
+ * <vinicius.miguel at unifesp.br>
+ * <ivan.muniz at unifesp.br>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LIBSTRING_HPP
+#define LIBSTRING_HPP
+
+// A header-only C++17 wrapper over libstring. libstring.c itself is still built as C.
+//
+// libstring::string owns a single cstr_t * and hands it back with string_free() once it
+// goes out of scope. Don't call string_free_all() while any of them is alive, since that
+// would free their strings from under them.
+
+#include <cstddef>
+#include <new>
+#include <string_view>
+
+#include "libstring.h"
+
+namespace libstring
+{
+
+// A string literal whose length is known at compile time. It is neither allocated nor
+// registered, so it can be passed to any libstring function that only reads its argument.
+class literal
+{
+public:
+    // Takes the characters of `lit` up to its first NUL, so arrays only partly filled (such as
+    // `char buf[16] = "ab"`) aren't taken whole. Use operator""_ls for literals with embedded NULs.
+    template <std::size_t N>
+    constexpr literal(const char (&lit)[N]) noexcept
+        : str_{ const_cast<char *>(lit), length(lit, N), length(lit, N), 0 }
+    {
+    }
+
+    constexpr literal(const char * value, std::size_t size) noexcept
+        : str_{ const_cast<char *>(value), size, size, 0 }
+    {
+    }
+
+    constexpr const char * c_str() const noexcept { return str_.value; }
+    constexpr std::size_t size() const noexcept { return str_.size; }
+    constexpr std::string_view view() const noexcept { return { str_.value, str_.size }; }
+    constexpr operator std::string_view() const noexcept { return view(); }
+
+    // libstring never writes to strings that aren't STRING_OWNED, so this cast is safe.
+    cstr_t * get() const noexcept { return const_cast<cstr_t *>(&str_); }
+
+private:
+    // Like std::char_traits<char>::length, but never reads past the end of the array.
+    static constexpr std::size_t length(const char * value, std::size_t max) noexcept
+    {
+        std::size_t size = 0;
+        while (size < max && value[size] != '\0')
+        {
+            ++size;
+        }
+        return size;
+    }
+
+    cstr_t str_;
+};
+
+namespace literals
+{
+    constexpr literal operator""_ls(const char * value, std::size_t size) noexcept
+    {
+        return literal(value, size);
+    }
+}
+
+class string
+{
+public:
+    string()
+        : string(std::string_view())
+    {
+    }
+
+    // As with string_init, a null pointer gives an empty string.
+    string(const char * value)
+        : string(value ? std::string_view(value) : std::string_view())
+    {
+    }
+
+    string(std::string_view value)
+        : str_(checked(string_init_n(value.data(), value.size())))
+    {
+    }
+
+    // Takes ownership of a string returned by libstring.
+    explicit string(cstr_t * str) noexcept
+        : str_(str)
+    {
+    }
+
+    // Copies share their buffer until either of them gets modified (see string_dup).
+    string(const string & other)
+        : str_(other.str_ ? checked(string_dup(other.str_)) : nullptr)
+    {
+    }
+
+    string(string && other) noexcept
+        : str_(other.str_)
+    {
+        other.str_ = nullptr;
+    }
+
+    string & operator=(const string & other)
+    {
+        if (this != &other)
+        {
+            string copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    string & operator=(string && other) noexcept
+    {
+        if (this != &other)
+        {
+            string_free(str_);
+            str_ = other.str_;
+            other.str_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~string()
+    {
+        string_free(str_);
+    }
+
+    // A moved-from string is empty and holds no cstr_t.
+    const char * c_str() const noexcept { return str_ ? str_->value : ""; }
+    std::size_t size() const noexcept { return str_ ? str_->size : 0; }
+    bool empty() const noexcept { return size() == 0; }
+    std::string_view view() const noexcept { return { c_str(), size() }; }
+    operator std::string_view() const noexcept { return view(); }
+
+    cstr_t * get() const noexcept { return str_; }
+
+    // Gives the cstr_t back to the caller, who then has to string_free it.
+    cstr_t * release() noexcept
+    {
+        cstr_t * str = str_;
+        str_ = nullptr;
+        return str;
+    }
+
+    void swap(string & other) noexcept
+    {
+        cstr_t * str = str_;
+        str_ = other.str_;
+        other.str_ = str;
+    }
+
+    string & operator+=(std::string_view value)
+    {
+        writable();
+        if (!value.empty() && !string_concat_to_n(str_, value.data(), value.size()))
+        {
+            throw std::bad_alloc();
+        }
+        return *this;
+    }
+
+    bool contains(std::string_view value) const noexcept
+    {
+        return str_ && string_contains_n(str_, value.data(), value.size());
+    }
+
+    // Returns the number of replacements. No replacement while there is something to replace means
+    // the call failed, and only then is string_last_error() looked at, so the caller's error state
+    // is left alone.
+    std::size_t replace(std::string_view old_val, std::string_view new_val)
+    {
+        std::size_t count;
+
+        writable();
+        count = string_replace_n(str_, old_val.data(), old_val.size(), new_val.data(), new_val.size());
+        if (!count && !old_val.empty() && string_contains_n(str_, old_val.data(), old_val.size()) &&
+            string_last_error() == STRING_ERR_ALLOC)
+        {
+            throw std::bad_alloc();
+        }
+        return count;
+    }
+
+    std::size_t replace(char before, char after)
+    {
+        std::size_t count;
+
+        writable();
+        count = string_replace_char(str_, before, after);
+        if (!count && string_index_of(str_, before) != STRING_NPOS && string_last_error() == STRING_ERR_ALLOC)
+        {
+            throw std::bad_alloc();
+        }
+        return count;
+    }
+
+    string to_lower_case() const { return string(checked(string_to_lower_case(str_ ? str_ : empty_str()))); }
+    string to_upper_case() const { return string(checked(string_to_upper_case(str_ ? str_ : empty_str()))); }
+    string fold_case() const { return string(checked(string_fold_case(str_ ? str_ : empty_str()))); }
+
+private:
+    static cstr_t * checked(cstr_t * str)
+    {
+        if (!str)
+        {
+            throw std::bad_alloc();
+        }
+        return str;
+    }
+
+    static cstr_t * empty_str() noexcept
+    {
+        static literal empty("");
+        return empty.get();
+    }
+
+    // Gives a moved-from string a cstr_t again before it gets modified.
+    void writable()
+    {
+        if (!str_)
+        {
+            str_ = checked(string_init_n("", 0));
+        }
+    }
+
+    cstr_t * str_;
+};
+
+inline void swap(string & a, string & b) noexcept
+{
+    a.swap(b);
+}
+
+inline bool operator==(const string & a, std::string_view b) noexcept { return a.view() == b; }
+inline bool operator!=(const string & a, std::string_view b) noexcept { return a.view() != b; }
+
+} // namespace libstring
+
+#endif // LIBSTRING_HPP
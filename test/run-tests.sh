@@ -7,9 +7,24 @@ else
     exit $127
 fi
 
+echo "Testing libstring.hpp under Valgrind (on -std=c++17)"
+gcc -std=gnu11 -c -o libstring-cpp.o ../src/libstring.c
+g++ -std=c++17 -o test-cpp tests.cpp libstring-cpp.o -lcriterion
+if valgrind --leak-check=full --error-exitcode=23 ./test-cpp; then
+    echo "Valgrind did not find any errors!"
+else
+    exit $127
+fi
+
 echo "Testing libstring under Valgrind (on -std=c89)"
-gcc -fpreprocessed -dD -E ../src/libstring.c >> ../src/89libstring.c
-gcc -fpreprocessed -dD -E ../src/libstring.h >> ../src/89libstring.h
+# Stripping comments reads every #define regardless of the #if around it, so any warning
+# here means the stripped sources might not be configured like the real ones
+if ! gcc -fpreprocessed -dD -E -Werror ../src/libstring.c > ../src/89libstring.c ||
+   ! gcc -fpreprocessed -dD -E -Werror ../src/libstring.h > ../src/89libstring.h; then
+    rm -f ../src/89libstring.c ../src/89libstring.h
+    echo "Stripping comments for the C89 build failed"
+    exit 1
+fi
 cp ../src/libstring.c ../src/libstring-backup.c 
 cp ../src/libstring.h ../src/libstring-backup.h 
 mv ../src/89libstring.c ../src/libstring.c
@@ -29,6 +29,11 @@ Test(libstring_tests, string_swap_test) {
     cstr_t * str2 = string_init("apples");
     string_swap(str1, str2);
     cr_expect(!strcmp(str1->value, "apples") && !strcmp(str2->value, "oranges"), "Expected str1 to have become \"apples\" and str2 to have become \"oranges\".");
+    cstr_t lit = STRING_LIT_INIT("pears");
+    cr_expect(!string_swap(str1, &lit) && string_last_error() == STRING_ERR_READONLY, "Expected a swap with a literal to be refused.");
+    cr_expect(!strcmp(str1->value, "apples") && !strcmp(lit.value, "pears"), "Expected a refused swap to leave both strings alone.");
+    cr_expect(string_concat_to(str1, " and pears") == 10, "Expected str1 to still be writable.");
+    string_clear_error();
     string_free_all();
 }
 
@@ -39,6 +44,19 @@ Test(libstring_tests, string_replace_char_test) {
     string_free_all();
 }
 
+Test(libstring_tests, string_index_of_test) {
+    cstr_t * str = string_init("Oompa loompas are doomed, said the Oompa-Loompa king.");
+    cstr_t * prefix = string_init("Oompa loompas");
+    cstr_t * suffix = string_init("king.");
+    cr_expect(string_index_of(str, 'a') == 4 && string_last_index_of(str, 'a') == 46, "Expected the first 'a' at 4 and the last one at 46.");
+    cr_expect(string_index_of(str, 'x') == STRING_NPOS && string_last_index_of(str, 'x') == STRING_NPOS, "Expected no 'x'.");
+    cr_expect(string_count_char(str, 'o') == 8 && string_count_char(str, 'O') == 2, "Expected 8 'o's and 2 'O's.");
+    cr_expect(string_starts_with_x(str, prefix) && !string_starts_with_x(str, suffix), "Expected str to start with \"Oompa loompas\" only.");
+    cr_expect(string_ends_with_x(str, suffix) && !string_ends_with_x(str, prefix) && !string_ends_with_x(suffix, str), "Expected str to end with \"king.\" only.");
+    cr_expect(string_replace_char(str, 'o', '0') == 8 && string_index_of(str, 'o') == STRING_NPOS, "Expected every 'o' to have been replaced.");
+    string_free_all();
+}
+
 Test(libstring_tests, string_update_test) {
     cstr_t * str = string_init("Oompa loompas are doomed.");
     string_update(str, "Oompa loompas are not doomed!");
@@ -84,4 +102,333 @@ Test(libstring_tests, string_replace_test) {
     string_replace(pathname, "home/user", "~");
     cr_expect(!strcmp(pathname->value, "~/path"), "Expected \"home/user\" to have been changed to \"~\".");
     string_free_all();
-}
\ No newline at end of file
+}
+
+Test(libstring_tests, string_to_lower_case_utf8_test) {
+    cstr_t * str = string_init("ÀÉÎÕÜ ΣΑΣ Москва Ⱥ");
+    cstr_t * strlow = string_to_lower_case(str);
+    cr_expect(!strcmp(strlow->value, "àéîõü σασ москва ⱥ"), "Expected \"ÀÉÎÕÜ ΣΑΣ Москва Ⱥ\" to have been transformed to \"àéîõü σασ москва ⱥ\".");
+    cr_expect(strlow->size == str->size + 1, "Expected U+023A to have grown by one byte when lower-cased.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_to_upper_case_utf8_test) {
+    cstr_t * str = string_init("straße ıi ёлка");
+    cstr_t * strup = string_to_upper_case(str);
+    cr_expect(!strcmp(strup->value, "STRAßE II ЁЛКА"), "Expected \"straße ıi ёлка\" to have been transformed to \"STRAßE II ЁЛКА\".");
+    cr_expect(strup->size == str->size - 1, "Expected U+0131 to have shrunk by one byte when upper-cased.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_fold_case_test) {
+    cstr_t * str = string_init("The KELVIN sign (\xE2\x84\xAA), ΣΑς and \xC5\xBF.");
+    cstr_t * strfold = string_fold_case(str);
+    cr_expect(!strcmp(strfold->value, "the kelvin sign (k), σασ and s."), "Expected the string to have been case-folded.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_case_tables_test) {
+    cstr_t * str = string_init("Ǆ Ȼ Ᏽ Ⱡ Ꙁ Ͱ Ɓ Ა 𐒰 𞤀");
+    cstr_t * strlow = string_to_lower_case(str);
+    cr_expect(!strcmp(strlow->value, "ǆ ȼ ᏽ ⱡ ꙁ ͱ ɓ ა 𐓘 𞤢"), "Expected letters outside Latin-1, Greek and Cyrillic to have been lower-cased.");
+    cstr_t * strup = string_to_upper_case(string_init("ǆ ɓ ᾀ ꭰ ⱥ"));
+    cr_expect(!strcmp(strup->value, "Ǆ Ɓ ᾈ Ꭰ Ⱥ"), "Expected letters outside Latin-1, Greek and Cyrillic to have been upper-cased.");
+    cstr_t * strfold = string_fold_case(string_init("Ꭰꭰ ᏸ ǅ"));
+    cr_expect(!strcmp(strfold->value, "ᎠᎠ Ᏸ ǆ"), "Expected Cherokee to fold to upper case and everything else to lower case.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_stats_snapshot_test) {
+    string_stats_t stats;
+#ifdef LIBSTRING_STATS
+    string_stats_reset();
+    cstr_t * str = string_init("test");
+    string_init("another test");
+    string_reserve(str, 20);
+    cr_assert(string_stats_snapshot(&stats), "Expected string_stats_snapshot to succeed when built with LIBSTRING_STATS.");
+    cr_expect(stats.live_strings == 2, "Expected 2 live strings.");
+    cr_expect(stats.bytes_used == 16, "Expected 16 bytes in use.");
+    cr_expect(stats.bytes_reserved == 33, "Expected 33 bytes reserved.");
+    cr_expect(stats.reallocs == 1, "Expected string_reserve to have reallocated once.");
+    cr_expect(stats.calls[STRING_STAT_INIT] == 2, "Expected string_init to have been called twice.");
+    string_free_all();
+#else
+    cr_expect(!string_stats_snapshot(&stats), "Expected string_stats_snapshot to fail without LIBSTRING_STATS.");
+#endif
+}
+
+static enum string_error handled_error = STRING_OK;
+
+static void test_error_handler(enum string_error error, const char * message, void * context) {
+    (void) message;
+    handled_error = error;
+    ++*(int *) context;
+}
+
+Test(libstring_tests, string_set_error_handler_test) {
+    int calls = 0;
+    string_clear_error();
+    string_set_error_handler(test_error_handler, &calls);
+#ifndef LIBSTRING_RELEASE   // Release builds don't check for NULL strings
+    cr_expect(string_update(NULL, "test") == 0, "Expected string_update on a NULL string to fail.");
+    cr_expect(calls == 1 && handled_error == STRING_ERR_NULL, "Expected the error handler to have been called with STRING_ERR_NULL.");
+    cr_expect(string_last_error() == STRING_ERR_NULL, "Expected string_last_error() to be STRING_ERR_NULL.");
+#endif
+    string_set_error_handler(NULL, NULL);
+    string_clear_error();
+    cr_expect(string_last_error() == STRING_OK, "Expected string_clear_error() to have reset the last error.");
+}
+
+static size_t live_blocks = 0;
+
+static void * counting_allocate(void * context, size_t size) {
+    ++*(size_t *) context;
+    live_blocks++;
+    return malloc(size);
+}
+
+static void * counting_reallocate(void * context, void * ptr, size_t old_size, size_t new_size) {
+    (void) old_size;
+    ++*(size_t *) context;
+    return realloc(ptr, new_size);
+}
+
+static void counting_deallocate(void * context, void * ptr, size_t size) {
+    (void) context; (void) size;
+    live_blocks--;
+    free(ptr);
+}
+
+Test(libstring_tests, string_set_allocator_test) {
+    size_t calls = 0;
+    string_allocator_t hooks = { counting_allocate, counting_reallocate, counting_deallocate, &calls };
+    cr_assert(string_set_allocator(&hooks), "Expected string_set_allocator to succeed with no live strings.");
+    cstr_t * str = string_init("test");
+    string_concat_to(str, " of the allocator hooks");
+    cr_expect(calls == 3, "Expected two allocations and one reallocation to go through the hooks.");
+    cr_expect(!string_set_allocator(NULL), "Expected string_set_allocator to fail while strings are live.");
+    size_t count;
+    cstr_view_t * parts = string_split(str, " ", &count);
+    string_regex_t * re = string_regex_compile("a+b");
+    string_free_all();
+    cr_expect(!string_set_allocator(NULL), "Expected string_set_allocator to fail while a split array and a regex are live.");
+    string_split_free(parts);
+    cr_expect(!string_set_allocator(NULL), "Expected string_set_allocator to fail while a regex is live.");
+    string_regex_free(re);
+    cr_expect(live_blocks == 0, "Expected every block to have been freed through the hooks.");
+    cr_expect(string_set_allocator(NULL), "Expected string_set_allocator to restore the system allocator.");
+}
+
+Test(libstring_tests, string_pool_allocator_test) {
+    string_pool_t * pool = string_pool_create();
+    string_allocator_t hooks = string_pool_allocator(pool);
+    cr_assert(string_set_allocator(&hooks), "Expected string_set_allocator to succeed with no live strings.");
+    cstr_t * str = string_init("The Carmesim");
+    size_t i;
+    for (i = 0; i < 300; i++) {
+        string_concat_to(str, " project.");
+    }
+    cstr_t * upper = string_to_upper_case(str);
+    cr_expect(str->size == 12 + 300 * 9, "Expected 300 concatenations to have been made.");
+    cr_expect(!strncmp(upper->value, "THE CARMESIM PROJECT. PROJECT.", 30), "Expected the pooled string to have been upper-cased.");
+    string_free_all();
+    string_set_allocator(NULL);
+    string_pool_destroy(pool);
+}
+
+Test(libstring_tests, string_dup_test) {
+    cstr_t * str  = string_init("The Carmesim");
+    cstr_t * copy = string_dup(str);
+    cr_expect(copy->value == str->value, "Expected string_dup to share the buffer of the original string.");
+    string_concat_to(copy, " project.");
+    cr_expect(copy->value != str->value, "Expected string_concat_to to have copied the shared buffer.");
+    cr_expect(!strcmp(str->value, "The Carmesim") && !strcmp(copy->value, "The Carmesim project."), "Expected only the copy to have been modified.");
+    cstr_t * lower = string_to_lower_case(string_init("already lower-case"));
+    cr_expect(!strcmp(lower->value, "already lower-case"), "Expected an unchanged lower-cased value.");
+    cr_expect(string_replace_char(copy, 'x', 'y') == 0, "Expected no replacements.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_mid_test) {
+    cstr_t * str = string_init("The Carmesim project.");
+    cstr_t * mid = string_mid(str, 4, 8);
+    cr_expect(!strcmp(mid->value, "Carmesim") && mid->size == 8, "Expected string_mid(str, 4, 8) to be \"Carmesim\".");
+    cstr_t * all = string_mid(str, 0, -1);
+    cr_expect(all->value == str->value && all->size == str->size, "Expected the whole string to share its buffer.");
+    string_free_all();
+}
+
+static cstr_t carmesim = STRING_LIT_INIT("Carmesim");
+
+Test(libstring_tests, string_lit_test) {
+    cstr_t * str = string_init("The Carmesim project.");
+    cr_expect(carmesim.size == 8 && !(carmesim.flags & STRING_OWNED), "Expected a static, unowned literal of size 8.");
+    cr_expect(string_contains(str, carmesim.value), "Expected string_contains(str, carmesim.value) to result in true.");
+    cr_expect(string_contains_view(str, STRING_VIEW_LIT("project")), "Expected string_contains_view(str, \"project\") to result in true.");
+    cr_expect(!string_contains_n(str, "The\0Carmesim", 12), "Expected the embedded NUL not to match.");
+    cr_expect(string_concat_to(&carmesim, "!") == 0 && string_last_error() == STRING_ERR_READONLY, "Expected literals to be read-only.");
+    cr_expect(!strcmp(carmesim.value, "Carmesim"), "Expected the literal to be untouched.");
+    string_concat_to_view(str, string_view(STRING_LIT(" The end.")));
+    cr_expect(!strcmp(str->value, "The Carmesim project. The end."), "Expected \" The end.\" to have been appended.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_replace_n_test) {
+    cstr_t * str = string_init("ab");
+    size_t i;
+    for (i = 0; i < 10; i++) {
+        string_concat_to_n(str, str->value, str->size);
+    }
+    cr_expect(str->size == 2048, "Expected the string to have doubled 10 times.");
+    cr_expect(string_replace_n(str, "b", 1, "ccc", 3) == 1024 && str->size == 4096, "Expected 1024 replacements growing the string to 4096 characters.");
+    cr_expect(!strncmp(str->value, "acccaccca", 9), "Expected every \"b\" to have become \"ccc\".");
+    cr_expect(string_replace_n(str, "accc", 4, "", 0) == 1024 && str->size == 0 && str->value[0] == '\0', "Expected every \"accc\" to have been removed.");
+    cstr_t * self = string_init("abab");
+    cr_expect(string_replace_n(self, self->value, 2, "x", 1) == 2 && !strcmp(self->value, "xx"), "Expected a needle taken from the string itself to be replaced everywhere.");
+    cr_expect(string_replace_n(self, "x", 1, self->value, 2) == 2 && !strcmp(self->value, "xxxx"), "Expected a replacement taken from the string itself to be copied before being overwritten.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_free_test) {
+    cstr_t * first  = string_init("first");
+    cstr_t * str    = string_init_n("The\0Carmesim", 12);
+    cstr_t * copy   = string_dup(str);
+    cstr_t * last   = string_init("last");
+    cr_expect(str->size == 12 && str->value[3] == '\0' && str->value[12] == '\0', "Expected string_init_n to keep the embedded NUL.");
+    string_free(str);
+    cr_expect(!memcmp(copy->value, "The\0Carmesim", 13), "Expected the copy to keep the shared buffer alive.");
+    string_free(last);
+    string_free(first);
+    string_free(NULL);
+    string_concat_to(copy, " project.");
+    cr_expect(copy->size == 21, "Expected the remaining string to still be usable.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_split_test) {
+    cstr_t * str = string_init("carmesim, ,libstring,,");
+    size_t count;
+    cstr_view_t * parts = string_split(str, ",", &count);
+    cr_assert(parts && count == 5, "Expected \"carmesim, ,libstring,,\" to have been split in 5 pieces.");
+    cr_expect(parts[0].size == 8 && !strncmp(parts[0].value, "carmesim", 8), "Expected the first piece to be \"carmesim\".");
+    cr_expect(parts[1].size == 1 && parts[3].size == 0 && parts[4].size == 0, "Expected the empty pieces to have been kept.");
+    cr_expect(parts[0].value == str->value, "Expected the pieces to point into the string's buffer.");
+    cr_expect(string_split_n(str, ",", 0, NULL) == NULL && string_last_error() == STRING_ERR_RANGE, "Expected an empty delimiter to be rejected.");
+    string_update(str, "modified");
+    string_free(str);
+    cr_expect(!strncmp(parts[2].value, "libstring", parts[2].size), "Expected the pieces to outlive the string.");
+    string_split_free(parts);
+    string_free_all();
+}
+
+Test(libstring_tests, string_join_test) {
+    cstr_t * str = string_init("the carmesim project");
+    size_t count;
+    cstr_view_t * parts = string_split(str, " ", &count);
+    cstr_t * joined = string_join(parts, count, ", ");
+    cr_expect(!strcmp(joined->value, "the, carmesim, project") && joined->size == 22, "Expected \"the, carmesim, project\".");
+    cr_expect(joined->reserved == 23, "Expected the joined string to have been allocated with its exact size.");
+    cstr_t * empty = string_join(parts, 0, ", ");
+    cr_expect(empty->size == 0 && empty->value[0] == '\0', "Expected joining nothing to give an empty string.");
+    string_split_free(parts);
+    string_free_all();
+}
+
+Test(libstring_tests, string_regex_match_test) {
+    cstr_t * str = string_init("The Carmesim project, since 2020.");
+    string_regex_t * re = string_regex_compile("Carm[a-z]+ (project|library), since \\d{4}\\.$");
+    cr_assert(re, "Expected the expression to compile.");
+    cr_expect(string_regex_match(re, str), "Expected the expression to match.");
+    cr_expect(!string_regex_match_view(re, string_view(string_init("The Carmesim library, since 20."))), "Expected \"20.\" not to match \"\\d{4}\\.\".");
+    string_regex_free(re);
+    re = string_regex_compile("^(a|b)*a(a|b){8}$");
+    cr_expect(string_regex_match(re, string_init("bbabbbbbbbb")) && !string_regex_match(re, string_init("bbbbbbbbbaa")), "Expected only the 9th character from the end to have to be an \"a\".");
+    string_regex_free(re);
+    cr_expect(string_regex_compile("(unbalanced") == NULL && string_last_error() == STRING_ERR_RANGE, "Expected an invalid expression to be rejected.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_glob_compile_test) {
+    string_regex_t * glob = string_glob_compile("src/*.[ch]");
+    cr_assert(glob, "Expected the glob to compile.");
+    cr_expect(string_regex_match(glob, string_init("src/libstring.c")) && string_regex_match(glob, string_init("src/lib/string.h")), "Expected \"src/*.[ch]\" to match.");
+    cr_expect(!string_regex_match(glob, string_init("src/libstring.hpp")) && !string_regex_match(glob, string_init("test/src/a.c")), "Expected globs to match whole strings.");
+    string_regex_free(glob);
+    glob = string_glob_compile("\\*?[!0-9]");
+    cr_expect(string_regex_match(glob, string_init("*ab")) && !string_regex_match(glob, string_init("*a1")), "Expected escapes and negated sets to work.");
+    string_regex_free(glob);
+    string_free_all();
+}
+
+Test(libstring_tests, string_index_build_test) {
+    cstr_t * str = string_init("abracadabra");
+    string_index_t * index = string_index_build(str);
+    size_t positions[4];
+    cr_assert(index, "Expected the index to have been built.");
+    cr_expect(string_index_contains(index, "cad", 3) && !string_index_contains(index, "abc", 3), "Expected \"cad\", but not \"abc\", to be found.");
+    cr_expect(string_index_count(index, "abra", 4) == 2 && string_index_count(index, "a", 1) == 5, "Expected \"abra\" twice and \"a\" 5 times.");
+    cr_expect(string_index_locate(index, "bra", 3, positions, 4) == 2 && positions[0] + positions[1] == 1 + 8, "Expected \"bra\" at 1 and 8.");
+    string_update(str, "modified");
+    cr_expect(string_index_count(index, "abra", 4) == 2, "Expected the index to keep the text it was built over.");
+    string_index_free(index);
+    string_free_all();
+}
+
+Test(libstring_tests, string_index_serialize_test) {
+    cstr_t * str = string_init_n("to be\0or not\0to be", 18);
+    string_index_t * index = string_index_build(str);
+    cstr_t * data = string_index_serialize(index);
+    string_index_t * loaded = string_index_load(data->value, data->size);
+    cr_assert(loaded, "Expected the serialized index to load.");
+    cr_expect(string_index_count(loaded, "to be", 5) == 2 && string_index_count(loaded, "\0", 1) == 2, "Expected the loaded index to answer like the original one.");
+    cr_expect(string_index_load(data->value, data->size - 1) == NULL && string_last_error() == STRING_ERR_RANGE, "Expected a truncated index to be rejected.");
+    string_index_free(loaded);
+    string_index_free(index);
+    string_free_all();
+}
+
+Test(libstring_tests, string_find_nocase_test) {
+    cstr_t * str = string_init("The CARMESIM Project, \xC3\x89T\xC3\x89 1\xE2\x84\xAA.");
+    cr_expect(string_find_nocase(str, "carmesim project") == 4, "Expected \"carmesim project\" at 4.");
+    cr_expect(string_contains_nocase(str, "\xC3\xa9t\xC3\xa9") && string_contains_nocase(str, "1k."), "Expected non-ASCII letters, and the Kelvin sign, to be matched regardless of case.");
+    cr_expect(string_find_nocase(str, "projects") == STRING_NPOS && !string_contains_nocase_n(str, "the\0", 4), "Expected no match.");
+    cr_expect(str->value[4] == 'C', "Expected the string not to have been modified.");
+    cr_expect(string_contains_nocase(string_init("x\xC7\x86y"), "\xC7\x84") && string_contains_nocase(string_init("\xC9\x93"), "\xC6\x81"),
+              "Expected U+01C6 to match U+01C4, and U+0253 to match U+0181, regardless of case.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_base64_encode_test) {
+    cstr_t * str = string_init("Oompa loompas!");
+    cstr_t * encoded = string_base64_encode(str);
+    cstr_t * decoded = string_base64_decode(encoded);
+    cstr_t * unpadded = string_init("T29tcGEgbG9vbXBhcyE");
+    cr_expect(!strcmp(encoded->value, "T29tcGEgbG9vbXBhcyE=") && encoded->size == 20, "Expected \"T29tcGEgbG9vbXBhcyE=\".");
+    cr_expect(decoded && decoded->size == str->size && !strcmp(decoded->value, str->value), "Expected the original string back.");
+    cr_expect(!strcmp(string_base64_decode(unpadded)->value, str->value), "Expected the padding to be optional.");
+    string_update(unpadded, "T29tcGE*bG9vbXBhcyE=");
+    cr_expect(string_base64_decode(unpadded) == NULL && string_last_error() == STRING_ERR_RANGE, "Expected invalid base64 to be rejected.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_hex_encode_test) {
+    cstr_t * str = string_init_n("\x00\x7F\x80\xFFlibstring", 13);
+    cstr_t * encoded = string_hex_encode(str);
+    cstr_t * upper = string_to_upper_case(encoded);
+    cstr_t * decoded = string_hex_decode(upper);
+    cr_expect(!strcmp(encoded->value, "007f80ff6c6962737472696e67") && encoded->size == 26, "Expected \"007f80ff6c6962737472696e67\".");
+    cr_expect(decoded && decoded->size == 13 && !memcmp(decoded->value, str->value, 13), "Expected the original bytes back.");
+    string_update(upper, "0g");
+    cr_expect(string_hex_decode(upper) == NULL && string_last_error() == STRING_ERR_RANGE, "Expected invalid hex to be rejected.");
+    string_free_all();
+}
+
+Test(libstring_tests, string_json_escape_test) {
+    cstr_t * str = string_init("Say \"hi\"\tto C:\\Users\n\x01 \xC3\xA9t\xC3\xA9");
+    cstr_t * plain = string_init("Nothing to escape here.");
+    cstr_t * escaped = string_json_escape(str);
+    cstr_t * same = string_json_escape(plain);
+    cr_expect(!strcmp(escaped->value, "Say \\\"hi\\\"\\tto C:\\\\Users\\n\\u0001 \xC3\xA9t\xC3\xA9") && escaped->size == strlen(escaped->value), "Expected quotes, backslashes and control characters to be escaped.");
+    cr_expect(same->value == plain->value, "Expected a string with nothing to escape to share its buffer.");
+    string_free_all();
+}
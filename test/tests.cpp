@@ -0,0 +1,49 @@
+#include "../src/libstring.hpp"
+#include <cstring>
+#include <string>
+#include <utility>
+#include <criterion/criterion.h>
+
+using namespace libstring::literals;
+
+Test(libstring_cpp_tests, string_raii_test) {
+    libstring::string str("The Carmesim");
+    libstring::string copy = str;
+    cr_expect(copy.get()->value == str.get()->value, "Expected copies to share their buffer.");
+    copy += " project.";
+    cr_expect(str == "The Carmesim" && copy == "The Carmesim project.", "Expected only the copy to have been modified.");
+    libstring::string moved = std::move(copy);
+    cr_expect(copy.get() == nullptr && copy.empty() && moved.size() == 21, "Expected the move to have stolen the cstr_t.");
+    copy += "again";
+    cr_expect(copy == "again", "Expected a moved-from string to be usable again.");
+    cr_expect(moved.replace("project", "library") == 1 && moved == "The Carmesim library.", "Expected \"project\" to have become \"library\".");
+    cr_expect(moved.to_upper_case() == "THE CARMESIM LIBRARY.", "Expected an upper-cased copy.");
+    string_set_error_handler([](enum string_error, const char *, void *) {}, nullptr);
+    string_replace_n(moved.get(), "", 0, "x", 1);
+    cr_expect(moved.replace("library", "project") == 1 && moved.replace('x', 'y') == 0, "Expected both replacements to succeed.");
+    cr_expect(string_last_error() == STRING_ERR_RANGE, "Expected replace to leave the caller's last error alone.");
+    string_set_error_handler(nullptr, nullptr);
+    string_clear_error();
+    const char * null = nullptr;
+    cr_expect(libstring::string(null).empty(), "Expected a null pointer to give an empty string.");
+}
+
+Test(libstring_cpp_tests, string_view_interop_test) {
+    std::string std_str("The\0Carmesim", 12);
+    libstring::string str{std::string_view(std_str)};
+    std::string_view view = str;
+    cr_expect(view.size() == 12 && view == std_str, "Expected the embedded NUL to survive the round trip.");
+    cr_expect(str.contains(std::string_view("\0Car", 4)), "Expected contains to take a string_view.");
+}
+
+Test(libstring_cpp_tests, string_literal_test) {
+    constexpr libstring::literal carmesim = "Carmesim";
+    constexpr auto project = "project"_ls;
+    static_assert(carmesim.size() == 8 && project.view() == "project", "Literal sizes are known at compile time.");
+    static constexpr char buf[16] = "ab";
+    static_assert(libstring::literal(buf).size() == 2, "Arrays are only taken up to their first NUL.");
+    static_assert(noexcept(libstring::string(std::declval<libstring::string &&>())), "Moves never throw.");
+    libstring::string str("The Carmesim project.");
+    cr_expect(string_contains(str.get(), carmesim.c_str()), "Expected the literal to be usable with the C API.");
+    cr_expect(str.contains(project), "Expected a literal to convert to std::string_view.");
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# Generates the case tables of src/libstring.c (lower_table, upper_table and fold_table) from the
+# Unicode Character Database:
+#
+#   python3 tools/gen-case-tables.py path/to/UnicodeData.txt path/to/CaseFolding.txt
+#
+# Both files can be found at https://www.unicode.org/Public/UCD/latest/ucd/. The tables are written to
+# stdout and replace everything from the "Generated by" comment up to the end of fold_table.
+
+import re
+import sys
+
+PER_LINE = 3
+
+
+def read_unicode_data(path):
+    """Returns the simple upper- and lower-case mappings (fields 12 and 13) as two dicts."""
+    upper, lower = {}, {}
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            fields = line.rstrip("\n").split(";")
+            if len(fields) < 15:
+                continue
+            cp = int(fields[0], 16)
+            if fields[12]:
+                upper[cp] = int(fields[12], 16)
+            if fields[13]:
+                lower[cp] = int(fields[13], 16)
+    return upper, lower
+
+
+def read_case_folding(path):
+    """Returns the simple case foldings (status C and S) as a dict, along with the Unicode version."""
+    fold, version = {}, None
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            match = re.match(r"#\s*CaseFolding-([\d.]+)\.txt", line)
+            if match:
+                version = match.group(1)
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            code, status, mapping = [field.strip() for field in line.split(";")[:3]]
+            if status in ("C", "S"):
+                fold[int(code, 16)] = int(mapping, 16)
+    return fold, version
+
+
+def utf8_len(cp):
+    return 1 if cp < 0x80 else 2 if cp < 0x800 else 3 if cp < 0x10000 else 4
+
+
+def check(mapping, name):
+    for cp, to in mapping.items():
+        # The ASCII fast paths map ASCII by themselves and never look non-ASCII up for an ASCII result
+        # they'd have to undo, so ASCII must only ever map to ASCII.
+        if cp < 0x80 and to >= 0x80:
+            sys.exit("%s: U+%04X maps out of ASCII" % (name, cp))
+        # __string_case_map reserves 1.5 times the original size
+        if 2 * utf8_len(to) > 3 * utf8_len(cp):
+            sys.exit("%s: U+%04X grows too much when encoded" % (name, cp))
+
+
+def ranges(mapping):
+    """Packs {code point: mapped code point} into runs of (lo, hi, delta, stride)."""
+    runs = []
+    for cp in sorted(mapping):
+        delta = mapping[cp] - cp
+        if runs:
+            lo, hi, run_delta, stride = runs[-1]
+            if run_delta == delta and cp == hi + 1 and (stride == 1 or lo == hi):
+                runs[-1] = (lo, cp, delta, 1)
+                continue
+            if run_delta == delta and cp == hi + 2 and (stride == 2 or lo == hi):
+                runs[-1] = (lo, cp, delta, 2)
+                continue
+        runs.append((cp, cp, delta, 1))
+    return runs
+
+
+def emit(name, runs):
+    print("static const struct case_range %s[] =" % name)
+    print("{")
+    for i in range(0, len(runs), PER_LINE):
+        cells = ["{ 0x%04X, 0x%04X,%6d, %d }," % run for run in runs[i:i + PER_LINE]]
+        print("    " + " ".join(cells))
+    print("};")
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: %s UnicodeData.txt CaseFolding.txt" % sys.argv[0])
+
+    upper, lower = read_unicode_data(sys.argv[1])
+    fold, version = read_case_folding(sys.argv[2])
+    for mapping, name in ((upper, "upper"), (lower, "lower"), (fold, "fold")):
+        check(mapping, name)
+
+    # Only the code points folding differently from how they lower-case need a fold_table entry,
+    # everything else falls back to lower_table
+    fold_only = {}
+    for cp in set(fold) | set(lower):
+        if cp >= 0x80 and fold.get(cp, cp) != lower.get(cp, cp):
+            fold_only[cp] = fold.get(cp, cp)
+
+    print("//! Generated by tools/gen-case-tables.py from the Unicode %s character database, do not edit by hand."
+          % (version or "(unknown version)"))
+    print()
+    print("//! Simple lower-case mappings (UnicodeData.txt field 13) outside of ASCII. Must be kept sorted.")
+    emit("lower_table", ranges({cp: to for cp, to in lower.items() if cp >= 0x80}))
+    print()
+    print("//! Simple upper-case mappings (UnicodeData.txt field 12) outside of ASCII. Must be kept sorted.")
+    emit("upper_table", ranges({cp: to for cp, to in upper.items() if cp >= 0x80}))
+    print()
+    print("//! Simple case foldings (CaseFolding.txt, status C and S) that differ from the lower-case mapping.")
+    print("//! A delta of 0 marks code points that lower-case but don't fold, such as U+0130 (it has no simple")
+    print("//! folding) or Cherokee, which folds to upper case.")
+    emit("fold_table", ranges(fold_only))
+
+
+if __name__ == "__main__":
+    main()